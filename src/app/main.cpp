@@ -4,7 +4,10 @@
 #include <math.h>
 #include <deque>
 #include <chrono>
-#include "../boids/boids.h"
+#include <cstring>
+#include <string>
+#include "../boids/scenario.h"
+#include "../boids/stream.h"
 
 #define T float // T means float
 #define dim 2 // dim means 2
@@ -22,11 +25,24 @@ typedef Vector<T, dim> TV;                      // TV is an Eigen vector 2*1, fl
 //Eigen quick ref: https://eigen.tuxfamily.org/dox/group__QuickRefPage.html
 
 public:
-    TestApp(int w, int h, const char * title) : Application(title, w, h) 
+    TestApp(int w, int h, const char * title, const Scenario<T, dim>& scenario) : Application(title, w, h) 
     {
         ImGui::StyleColorsClassic();
         const char* name = IMGUI_FONT_FOLDER"/Cousine-Regular.ttf";
         nvgCreateFont(vg, "sans", name);
+
+        boids = Boids<T, dim>(scenario.boid_number, scenario.params);
+        boids.seed(scenario.seed);
+        currentMethod = oldMethod = scenario.method;
+        boids.initializePositions(currentMethod);
+    }
+
+    // draw the frames of a runner --serve instead of simulating, the keys, the method
+    // and the mouse target go to it; throws when it is not there
+    void connect(const std::string& address)
+    {
+        client.connect(address);
+        streaming = true;
     }
 
     void process() override 
@@ -35,9 +51,15 @@ public:
         if(std::chrono::duration_cast<std::chrono::microseconds>(now-lastFrame).count() >= 10./60. * 1.e6)
         {
             if(keyDown[GLFW_KEY_R])                 // if keyinput = R, initialize again (refresh)
-                boids.initializePositions(currentMethod); // initialize positions and velocities according to current method
+            {
+                if(streaming) client.send("reinit");
+                else boids.initializePositions(currentMethod); // initialize positions and velocities according to current method
+            }
             if(keyDown[GLFW_KEY_SPACE])             // if keyinput = space, pause simulation
-                boids.pause();
+            {
+                if(streaming) client.send("pause");
+                else boids.pause();
+            }
             if(keyDown[GLFW_KEY_ESCAPE])            // if keyinput = ESC, exit simulation
                 exit(0);
             lastFrame = now;
@@ -51,20 +73,63 @@ public:
                             "Cohesion", "Alignment", "Separation", "Collision Avoidance",
                             "Leading","Collaborative & Adversarial"};
        Combo("Boids Behavior", (int*)&currentMethod, names, 8);
+       if(boids.getParams().sleeping) Text("sleeping: %.0f%%", 100*boids.getSleepingFraction());
+       if(!stream_error.empty()) TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "%s", stream_error.c_str());
        End();
     }
 
     void drawNanoVG() override 
     {
-        // automatically initialize when currentMethod is changed
+        // automatically initialize when currentMethod is changed, the runner does when streaming
         if(currentMethod != oldMethod)
         {
-            boids.initializePositions(currentMethod);
+            if(streaming) client.send(std::string("method ") + methodName(currentMethod));
+            else boids.initializePositions(currentMethod);
             oldMethod = currentMethod;
         }
 
-        boids.updateBehavior(currentMethod);
-        TVStack boids_pos = boids.getPositions();
+        TVStack boids_pos, A_pos, B_pos;
+        int leaders = 1;
+        if(streaming)
+        {
+            // the latest frame, the last one stays when the runner is gone
+            std::string message;
+            StreamFrameInfo info;
+            try
+            {
+                if(client.receive(message) && decodeFrame(message, remote_pos, info))
+                {
+                    remote_info = info;
+                    currentMethod = oldMethod = MethodTypes(info.method);
+                }
+            }
+            catch(const std::exception& e)
+            {
+                // frames of a 3d runner, this app draws 2d
+                stream_error = e.what();
+                std::cerr<<stream_error<<'\n';
+                client.close();
+            }
+            boids_pos = remote_pos;
+            const int team_a = std::min(remote_info.team_a, int(remote_pos.cols()));
+            A_pos = remote_pos.leftCols(team_a);
+            B_pos = remote_pos.rightCols(remote_pos.cols() - team_a);
+            leaders = std::max(remote_info.leaders, 1);
+        }
+        else
+        {
+            boids.updateBehavior(currentMethod);
+            boids_pos = boids.getPositions();
+            if(currentMethod == CA_BEHAVE)
+            {
+                A_pos = boids.get_A_pos();
+                B_pos = boids.get_B_pos();
+            }
+            // with several leaders they are the first columns
+            leaders = std::max(int(boids.getGroupStart().size()) - 1, 1);
+        }
+
+        PROFILE_SCOPE("draw boids");
         
         // plot mapping function revised for better visulization
         // origin (0,0) is in the middle
@@ -75,14 +140,43 @@ public:
             return TV(0.5*(1 - scale)*width + 0.25*pos_01[0]*(1 - scale)*width, 0.5*height + 0.25*pos_01[1]*height);
         };
 
+        // periodic box, boids leaving it come back on the other side
+        if(boids.getParams().periodic)
+        {
+            T half = boids.getParams().period/2;
+            TV corner = shift_01_to_screen(TV(-half, -half), scale, width, height);
+            nvgBeginPath(vg);
+            nvgRect(vg, corner[0], corner[1], 180*2*half, 180*2*half);
+            nvgStrokeColor(vg, BLUE);
+            nvgStroke(vg);
+        }
+
         // if currentMethod is collision avoidance, draw obstacles
         if (currentMethod == COLLISION_AVOID)
         {
-            nvgBeginPath(vg);
-            TV obs_pos = shift_01_to_screen(boids.get_obs_pos(), scale, width, height);
-            nvgCircle(vg, obs_pos[0], obs_pos[1],180*boids.get_obs_radius()); // radius = 36 pixels = 0.2, type float
-            nvgFillColor(vg, GREEN);
-            nvgFill(vg);
+            if(boids.getObstacles().empty())
+            {
+                nvgBeginPath(vg);
+                TV obs_pos = shift_01_to_screen(boids.get_obs_pos(), scale, width, height);
+                nvgCircle(vg, obs_pos[0], obs_pos[1],180*boids.get_obs_radius()); // radius = 36 pixels = 0.2, type float
+                nvgFillColor(vg, GREEN);
+                nvgFill(vg);
+            }
+            for(const Obstacle<T>& obstacle : boids.getObstacles())
+            {
+                nvgBeginPath(vg);
+                TV center = shift_01_to_screen(TV(obstacle.center[0], obstacle.center[1]), scale, width, height);
+                if(obstacle.vertices.size() < 3) nvgCircle(vg, center[0], center[1], 180*obstacle.radius);
+                else
+                {
+                    nvgMoveTo(vg, center[0] + 180*obstacle.vertices[0][0], center[1] + 180*obstacle.vertices[0][1]);
+                    for(size_t k=1;k<obstacle.vertices.size();k++)
+                        nvgLineTo(vg, center[0] + 180*obstacle.vertices[k][0], center[1] + 180*obstacle.vertices[k][1]);
+                    nvgClosePath(vg);
+                }
+                nvgFillColor(vg, GREEN);
+                nvgFill(vg);
+            }
 
             nvgBeginPath(vg);
             TV goal_pos = shift_01_to_screen(boids.get_goal_pos(), scale, width, height);
@@ -95,21 +189,23 @@ public:
         // if currentMethod is leader, draw the leader birds
         if(currentMethod == LEADER)
         {
-            TV pos = boids_pos.col(0);
-            
             // drag mouse target
             nvgBeginPath(vg);
             nvgCircle(vg, mouse_pos_pixels[0], mouse_pos_pixels[1],4.f);
             nvgFillColor(vg, GREEN);
             nvgFill(vg);
 
-            nvgBeginPath(vg);
-            // just map position from 01 simulation space to screen space
-            TV screen_pos = shift_01_to_screen(TV(pos[0], pos[1]), scale, width, height);
-            nvgCircle(vg, screen_pos[0], screen_pos[1], 4.f);
-            nvgFillColor(vg, BLUE);
-            nvgFill(vg);
-            for(int i = 1; i < boids.getParticleNumber(); i++)
+            for(int i = 0; i < std::min(leaders, int(boids_pos.cols())); i++)
+            {
+                TV pos = boids_pos.col(i);
+                nvgBeginPath(vg);
+                // just map position from 01 simulation space to screen space
+                TV screen_pos = shift_01_to_screen(TV(pos[0], pos[1]), scale, width, height);
+                nvgCircle(vg, screen_pos[0], screen_pos[1], 4.f);
+                nvgFillColor(vg, BLUE);
+                nvgFill(vg);
+            }
+            for(int i = leaders; i < boids_pos.cols(); i++)
             {
                 TV pos = boids_pos.col(i);
                 nvgBeginPath(vg);
@@ -122,8 +218,6 @@ public:
         }
         else if (currentMethod == CA_BEHAVE)
         {
-            TVStack A_pos = boids.get_A_pos();
-            TVStack B_pos = boids.get_B_pos();
             for(int i = 0; i < A_pos.cols(); i++)
             {
                 TV pos = A_pos.col(i);
@@ -146,7 +240,7 @@ public:
         else
         {
             // draw boids
-            for(int i = 0; i < boids.getParticleNumber(); i++)
+            for(int i = 0; i < boids_pos.cols(); i++)
             {
                 TV pos = boids_pos.col(i);
                 nvgBeginPath(vg);
@@ -166,10 +260,22 @@ protected:
         mouse_pos[0] = (mouse_pos_pixels[0] - 0.5*(1 - scale)*width)/0.25/(1 - scale)/width;
         mouse_pos[1] = (mouse_pos_pixels[1] - 0.5*height           )/0.25/height;
         boids.getMousePos(mouse_pos);
+        if(streaming) client.send("target " + std::to_string(mouse_pos[0]) + " " + std::to_string(mouse_pos[1]));
         if(currentMethod == LEADER)
         {
             std::cout<<"current leader target: ("<<mouse_pos[0]<<","<<mouse_pos[1]<<")"<<'\n';
         }
+        // a click moves the nearest obstacle of the set to the mouse; when streaming, in the runner too,
+        // the local copy is only drawn
+        const std::vector<Obstacle<T>>& obstacles = boids.getObstacles();
+        if(currentMethod == COLLISION_AVOID && !obstacles.empty())
+        {
+            int nearest = 0;
+            for(int k=1;k<int(obstacles.size());k++)
+                if((obstacles[k].center-mouse_pos).norm() < (obstacles[nearest].center-mouse_pos).norm()) nearest = k;
+            boids.moveObstacle(nearest, mouse_pos);
+            if(streaming) client.send("obstacle " + std::to_string(nearest) + " " + std::to_string(mouse_pos[0]) + " " + std::to_string(mouse_pos[1]));
+        }
     }
     void mouseButtonReleased(int button, int mods) override {}
 
@@ -193,18 +299,56 @@ private:
 private:
     MethodTypes currentMethod = FREEFALL;
     MethodTypes oldMethod = FREEFALL;
-    Boids<T, dim> boids = Boids<T, dim>(40); //<---- boids number changes here, should be even number
+    Boids<T, dim> boids; //<---- boids number is set by the scenario, should be even number
     std::chrono::high_resolution_clock::time_point lastFrame;
     float scale = 0.33333;
     TV mouse_pos = TV(0,0);
     TV mouse_pos_pixels = TV(0,0);
+    StreamClient client;                    // app --connect: a runner --serve simulates
+    bool streaming = false;
+    TVStack remote_pos = TVStack::Zero(dim, 0);
+    StreamFrameInfo remote_info = StreamFrameInfo{FREEFALL, 0, 0, 0};
+    std::string stream_error;               // why the stream stopped, shown in the menu
 };
 
-int main(int, char**)
+// usage: app [scenario.json] [--connect unix:<path> | tcp:<port>], without a scenario file the defaults in boids.h are used
+// --connect draws a runner --serve (stream.h), give it the runner's scenario to see the same obstacles
+int main(int argc, char** argv)
 {
+    Scenario<T, dim> scenario;
+    std::string address;
+    for(int i=1;i<argc;i++)
+    {
+        if(!strcmp(argv[i], "--connect") && i+1 < argc)
+        {
+            address = argv[++i];
+            continue;
+        }
+        try
+        {
+            scenario = loadScenario<T, dim>(argv[i]);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr<<e.what()<<'\n';
+            return 1;
+        }
+    }
     int width = 1080;
     int height = 720;
-    TestApp app(width, height, "Assignment 3 Boids");
+    TestApp app(width, height, "Assignment 3 Boids", scenario);
+    if(!address.empty())
+    {
+        try
+        {
+            app.connect(address);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr<<e.what()<<'\n';
+            return 1;
+        }
+    }
     app.run();
     return 0;
 }
@@ -0,0 +1,978 @@
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "scenario.h"
+#include "perf_counters.h"
+#include "shared_state.h"
+#include "stream.h"
+
+#define T float // T means float
+#define dim 2 // dim means 2
+
+// benchmark harness
+// usage: bench [section...] [--n 40,400,1000] [--reps R] [--perf]
+// sections: see benchSections(), kernels by default; --n and --reps set the boid numbers and
+// repetitions of the sections that time boids
+// --perf adds hardware counters (perf_counters.h) to every row, all numbers are per boid and step
+
+typedef Matrix<T, dim, Eigen::Dynamic> TVStack;
+typedef Vector<T, dim> TV;
+
+struct BenchOptions
+{
+    std::vector<int> sizes = {40, 400, 1000};
+    int reps = 0;           // 0 -> chosen per size, roughly constant work
+    bool perf = false;
+};
+
+typedef std::chrono::high_resolution_clock Clock;
+
+double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now()-start).count();
+}
+
+void resetFormat()
+{
+    std::cout<<std::defaultfloat<<std::setprecision(6);
+}
+
+// --reps, or enough repetitions for about 2e7 units of work per row (pairs for the force kernels)
+int repsFor(const BenchOptions& options, double work)
+{
+    return options.reps > 0 ? options.reps : std::max(3, int(2e7/work));
+}
+
+// times reps calls of fn, prints one row per boid and step, suffix is appended to the row
+void measure(const std::string& label, int n, int reps, const BenchOptions& options, const std::function<void()>& fn,
+             const std::string& suffix = "")
+{
+    PerfCounters& counters = PerfCounters::thisThread();
+    uint64_t before[PerfCounters::COUNT], after[PerfCounters::COUNT];
+    fn(); // warm up
+    bool counting = options.perf && counters.read(before);
+    auto start = Clock::now();
+    for(int r=0;r<reps;r++) fn();
+    auto end = Clock::now();
+    counting = counting && counters.read(after);
+
+    double units = double(n)*reps;
+    std::cout<<std::left<<std::setw(28)<<label<<std::right<<std::setw(8)<<n
+             <<std::setw(12)<<std::fixed<<std::setprecision(2)<<std::chrono::duration<double, std::nano>(end-start).count()/units;
+    if(options.perf)
+    {
+        for(int k=0;k<PerfCounters::COUNT;k++)
+        {
+            if(counting && counters.valid(k)) std::cout<<std::setw(15)<<(after[k]-before[k])/units;
+            else std::cout<<std::setw(15)<<"n/a";
+        }
+    }
+    std::cout<<suffix<<'\n';
+    resetFormat();
+}
+
+// header of the measure rows, columns names their suffix
+void printHeader(const BenchOptions& options, const std::string& columns = "")
+{
+    std::cout<<std::left<<std::setw(28)<<"kernel"<<std::right<<std::setw(8)<<"boids"<<std::setw(12)<<"ns";
+    if(options.perf)
+        for(int k=0;k<PerfCounters::COUNT;k++) std::cout<<std::setw(15)<<PerfCounters::name(k);
+    std::cout<<columns<<'\n';
+}
+
+// the flock of every section: seeded with 1, spawned for type and running
+template <class Scalar, int d>
+void spawn(Boids<Scalar, d>& boids, MethodTypes type)
+{
+    boids.seed(1);
+    boids.initializePositions(type);
+    boids.pause(); // a new flock starts paused
+}
+
+// ms of steps updates of type
+template <class Scalar, int d>
+double timeSteps(Boids<Scalar, d>& boids, MethodTypes type, int steps)
+{
+    auto start = Clock::now();
+    for(int s=0;s<steps;s++) boids.updateBehavior(type);
+    return msSince(start);
+}
+
+// ms of the updates of type until the simulated time t_end, steps counts them
+template <class Scalar, int d>
+double timeUntil(Boids<Scalar, d>& boids, MethodTypes type, double t_end, int& steps)
+{
+    auto start = Clock::now();
+    for(steps=0;boids.getTime() < t_end;steps++) boids.updateBehavior(type);
+    return msSince(start);
+}
+
+// one measure row of the forces of type on pos
+template <class Scalar, int d>
+void measureAcc(const std::string& label, int n, int reps, const BenchOptions& options, Boids<Scalar, d>& boids, MethodTypes type,
+                const Matrix<Scalar, d, Eigen::Dynamic>& pos, const std::string& suffix = "")
+{
+    measure(label, n, reps, options, [&]() {
+        volatile double sink = double(boids.getAcc(type, pos)(0, 0));
+        (void)sink;
+    }, suffix);
+}
+
+// force kernels of every flocking method, CA_acc and attack
+void benchKernels(const BenchOptions& options)
+{
+    std::cout<<"== kernels, per boid and step"<<'\n';
+    printHeader(options);
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        for(MethodTypes type : {COHESION, ALIGNMENT, SEPARATION, COLLISION_AVOID, LEADER})
+        {
+            Boids<T, dim> boids(n);
+            spawn(boids, type);
+            measureAcc(std::string("getAcc ") + methodName(type), n, reps, options, boids, type, boids.getPositions());
+        }
+
+        Boids<T, dim> boids(n);
+        spawn(boids, CA_BEHAVE);
+        TVStack A_pos = boids.get_A_pos(), A_vel = boids.get_A_vel();
+        TVStack B_pos = boids.get_B_pos(), B_vel = boids.get_B_vel();
+        measure("CA_acc", n, reps, options, [&]() {
+            volatile T sink = boids.CA_acc(A_pos, A_vel)(0, 0);
+            volatile T sink2 = boids.CA_acc(B_pos, B_vel)(0, 0);
+            (void)sink; (void)sink2;
+        });
+        measure("attack", n, reps, options, [&]() {
+            TVStack posA = A_pos, posB = B_pos, velA = A_vel, velB = B_vel;
+            boids.attack(posA, posB, velA, velB);
+        });
+    }
+}
+
+// accuracy against cost of every integrator on CIRCULAR_MOTION, whose exact
+// solution is x(t) = x0 cos t + v0 sin t; every run integrates one orbit (t = 2 pi)
+void benchIntegrators(const BenchOptions& options)
+{
+    const int n = options.sizes.front();
+    const double t_end = 2*M_PI;
+    const double steps_sizes[] = {0.0005, 0.005, 0.05, 0.2};
+    std::cout<<"== integrators, CIRCULAR_MOTION, "<<n<<" boids, one orbit"<<'\n';
+    std::cout<<std::left<<std::setw(20)<<"integrator"<<std::right<<std::setw(10)<<"h"<<std::setw(10)<<"steps"
+             <<std::setw(14)<<"evals/orbit"<<std::setw(12)<<"ms"<<std::setw(14)<<"max error"<<'\n';
+    for(int mode=BASIC_EULER;mode<=RK4;mode++)
+    {
+        for(double h : steps_sizes)
+        {
+            BoidsParams<T, dim> params;
+            params.updateMode = mode;
+            int steps = int(std::lround(t_end/h));
+            params.h = T(t_end/steps);
+            Boids<T, dim> boids(n, params);
+            spawn(boids, CIRCULAR_MOTION);
+            TVStack x0 = boids.getPositions(), v0 = boids.getVelocities();
+            double ms = timeSteps(boids, CIRCULAR_MOTION, steps);
+
+            double t = double(steps)*params.h;
+            TVStack exact = x0*T(std::cos(t)) + v0*T(std::sin(t));
+            double error = (boids.getPositions() - exact).colwise().norm().maxCoeff();
+            std::cout<<std::left<<std::setw(20)<<getIntegrator<T, dim>(mode).name()<<std::right
+                     <<std::setw(10)<<std::defaultfloat<<h<<std::setw(10)<<steps<<std::setw(14)<<boids.getForceEvaluations()
+                     <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms
+                     <<std::setw(14)<<std::scientific<<std::setprecision(2)<<error<<'\n';
+            resetFormat();
+        }
+    }
+
+    // the adaptive integrator picks its steps, the h column is its tolerance; h_max up to a
+    // quarter orbit, at the default 0.05 every tolerance here would run into it
+    const double tolerances[] = {1e-3, 1e-4, 1e-5, 1e-6};
+    for(double tolerance : tolerances)
+    {
+        BoidsParams<T, dim> params;
+        params.updateMode = ADAPTIVE;
+        params.tolerance = T(tolerance);
+        params.h_max = T(M_PI/2);
+        Boids<T, dim> boids(n, params);
+        spawn(boids, CIRCULAR_MOTION);
+        TVStack x0 = boids.getPositions(), v0 = boids.getVelocities();
+        int steps;
+        double ms = timeUntil(boids, CIRCULAR_MOTION, t_end, steps);
+
+        double t = boids.getTime();
+        TVStack exact = x0*T(std::cos(t)) + v0*T(std::sin(t));
+        double error = (boids.getPositions() - exact).colwise().norm().maxCoeff();
+        std::cout<<std::left<<std::setw(20)<<"adaptive, tol"<<std::right
+                 <<std::setw(10)<<std::defaultfloat<<tolerance<<std::setw(10)<<steps<<std::setw(14)<<boids.getForceEvaluations()
+                 <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms
+                 <<std::setw(14)<<std::scientific<<std::setprecision(2)<<error
+                 <<"  ("<<boids.getIntegratorState().rejected<<" rejected)"<<'\n';
+        resetFormat();
+    }
+
+    // flocks: cost of the same simulated time with the default fixed step and adaptively,
+    // cohesion and alignment calm down, the cut-off forces of collision avoidance keep the steps
+    // small; without the floor at h the steps collapse there and most tries are rejected
+    const double t_flock = 2;
+    struct Run { const char* name; int mode; bool floor; };
+    const Run runs[] = {{nullptr, SYMPLECTIC_EULER, true}, {nullptr, VELOCITY_VERLET, true},
+                        {nullptr, ADAPTIVE, true}, {"adaptive, no floor", ADAPTIVE, false}};
+    std::cout<<"== integrators, "<<n<<" boids, simulated time "<<t_flock<<'\n';
+    std::cout<<std::left<<std::setw(20)<<"method"<<std::setw(20)<<"integrator"<<std::right<<std::setw(10)<<"steps"
+             <<std::setw(14)<<"evals"<<std::setw(12)<<"ms"<<std::setw(12)<<"rejected"<<std::setw(12)<<"forced"<<'\n';
+    for(MethodTypes type : {COHESION, ALIGNMENT, COLLISION_AVOID})
+    {
+        for(const Run& run : runs)
+        {
+            BoidsParams<T, dim> params;
+            params.updateMode = run.mode;
+            params.adaptive_floor = run.floor;
+            Boids<T, dim> boids(n, params);
+            spawn(boids, type);
+            int steps;
+            double ms = timeUntil(boids, type, t_flock, steps);
+            std::cout<<std::left<<std::setw(20)<<methodName(type)<<std::setw(20)<<(run.name ? run.name : getIntegrator<T, dim>(run.mode).name())<<std::right
+                     <<std::setw(10)<<steps<<std::setw(14)<<boids.getForceEvaluations()
+                     <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms
+                     <<std::setw(12)<<boids.getIntegratorState().rejected<<std::setw(12)<<boids.getIntegratorState().forced<<'\n';
+            resetFormat();
+        }
+    }
+
+    // multirate: cohesion/alignment every k steps, velocity verlet (k = 1) is the reference;
+    // on the neighbor grid, else the fast repulsion pass walks all pairs and costs as much as the slow one
+    const int flock_steps = 2000;
+    std::cout<<"== multirate, "<<n<<" boids, "<<flock_steps<<" steps"<<'\n';
+    std::cout<<std::left<<std::setw(20)<<"method"<<std::setw(20)<<"integrator"<<std::right<<std::setw(10)<<"k"
+             <<std::setw(14)<<"wide evals"<<std::setw(14)<<"evals"<<std::setw(12)<<"ms"<<std::setw(14)<<"mean drift"<<'\n';
+    for(MethodTypes type : {SEPARATION, COLLISION_AVOID})
+    {
+        TVStack reference;
+        for(int k : {1, 2, 4, 8})
+        {
+            BoidsParams<T, dim> params;
+            params.updateMode = k == 1 ? VELOCITY_VERLET : MULTIRATE;
+            params.respa_steps = k;
+            params.neighbor_grid = true;
+            Boids<T, dim> boids(n, params);
+            spawn(boids, type);
+            double ms = timeSteps(boids, type, flock_steps);
+            if(k == 1) reference = boids.getPositions();
+            double drift = (boids.getPositions() - reference).colwise().norm().mean();
+            std::cout<<std::left<<std::setw(20)<<methodName(type)<<std::setw(20)<<getIntegrator<T, dim>(params.updateMode).name()<<std::right
+                     <<std::setw(10)<<k<<std::setw(14)<<boids.getWideEvaluations()<<std::setw(14)<<boids.getForceEvaluations()
+                     <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms
+                     <<std::setw(14)<<std::scientific<<std::setprecision(2)<<drift<<'\n';
+            resetFormat();
+        }
+    }
+}
+
+// mean distance of every boid to its nearest neighbor, brute force
+double meanNearestDistance(const TVStack& pos)
+{
+    double sum = 0;
+    for(int i=0;i<pos.cols();i++)
+    {
+        double nearest = 1e30;
+        for(int j=0;j<pos.cols();j++)
+            if(j != i) nearest = std::min(nearest, double((pos.col(i)-pos.col(j)).norm()));
+        sum += nearest;
+    }
+    return pos.cols() > 1 ? sum/pos.cols() : 0;
+}
+
+// explicit against semi-implicit separation springs with growing h, same simulated time;
+// a stable step keeps the spacing and the speed of the h = 0.0005 flock
+void benchImplicit(const BenchOptions& options)
+{
+    const double t_end = 3;
+    const double steps_sizes[] = {0.0005, 0.005, 0.025, 0.05};
+    for(int n : options.sizes)
+    {
+        std::cout<<"== implicit repulsion, SEPARATION, "<<n<<" boids, simulated time "<<t_end<<'\n';
+        std::cout<<std::left<<std::setw(12)<<"repulsion"<<std::right<<std::setw(10)<<"h"<<std::setw(10)<<"steps"<<std::setw(12)<<"ms"
+                 <<std::setw(14)<<"cg its/solve"<<std::setw(14)<<"mean speed"<<std::setw(14)<<"nearest"<<'\n';
+        for(int implicit=0;implicit<2;implicit++)
+        {
+            for(double h : steps_sizes)
+            {
+                BoidsParams<T, dim> params;
+                params.h = T(h);
+                params.implicit_repulsion = implicit;
+                Boids<T, dim> boids(n, params);
+                spawn(boids, SEPARATION);
+                int steps = int(std::lround(t_end/h));
+                double ms = timeSteps(boids, SEPARATION, steps);
+                const RepulsionSolver<T, dim>& solver = boids.getRepulsionSolver();
+                std::cout<<std::left<<std::setw(12)<<(implicit ? "implicit" : "explicit")<<std::right
+                         <<std::setw(10)<<h<<std::setw(10)<<steps
+                         <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms
+                         <<std::setw(14)<<std::setprecision(2)<<(solver.solves > 0 ? double(solver.iterations)/solver.solves : 0.)
+                         <<std::setw(14)<<std::setprecision(3)<<boids.getVelocities().colwise().norm().mean()
+                         <<std::setw(14)<<meanNearestDistance(boids.getPositions())<<'\n';
+                resetFormat();
+            }
+        }
+    }
+}
+
+// COLLISION_AVOID until the flock settled at the goal, with and without sleeping boids
+void benchSleeping(const BenchOptions& options)
+{
+    const int steps = 20000;
+    const int report_every = 4000;
+    for(int n : options.sizes)
+    {
+        std::cout<<"== sleeping, COLLISION_AVOID, "<<n<<" boids"<<'\n';
+        std::cout<<std::left<<std::setw(12)<<"sleeping"<<std::right<<std::setw(10)<<"steps"<<std::setw(12)<<"ms"
+                 <<std::setw(12)<<"asleep %"<<std::setw(22)<<"centroid"<<'\n';
+        for(int sleeping=0;sleeping<2;sleeping++)
+        {
+            BoidsParams<T, dim> params;
+            params.sleeping = sleeping;
+            Boids<T, dim> boids(n, params);
+            spawn(boids, COLLISION_AVOID);
+            double ms = 0;
+            for(int done=0;done<steps;done+=report_every)
+            {
+                ms += timeSteps(boids, COLLISION_AVOID, report_every);
+                TV centroid = boids.getPositions().rowwise().mean();
+                std::cout<<std::left<<std::setw(12)<<(sleeping ? "on" : "off")<<std::right<<std::setw(10)<<done+report_every
+                         <<std::setw(12)<<std::fixed<<std::setprecision(1)<<ms
+                         <<std::setw(12)<<100*boids.getSleepingFraction()
+                         <<std::setprecision(3)<<std::setw(11)<<centroid[0]<<std::setw(11)<<centroid[1]<<'\n';
+                resetFormat();
+            }
+        }
+    }
+}
+
+// COLLISION_AVOID forces with all pairs vs the neighbor grid, in 2d and 3d (the neighbor_grid
+// test checks they agree); the boids are spread over a box of side (n/40)^(1/d), the density
+// of 40 boids in the unit box
+template <int d>
+void benchGridDim(const BenchOptions& options)
+{
+    std::cout<<"== neighbor grid, COLLISION_AVOID, "<<d<<"d, per boid and step"<<'\n';
+    printHeader(options);
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        for(int use_grid=0;use_grid<2;use_grid++)
+        {
+            BoidsParams<T, d> params;
+            params.neighbor_grid = use_grid;
+            Boids<T, d> boids(n, params);
+            spawn(boids, COLLISION_AVOID);
+            measureAcc(use_grid ? "grid" : "all pairs", n, reps, options, boids, COLLISION_AVOID,
+                       Matrix<T, d, Eigen::Dynamic>(boids.getPositions()*T(std::pow(n/40., 1./d))));
+        }
+    }
+}
+
+void benchGrid(const BenchOptions& options)
+{
+    benchGridDim<2>(options);
+    benchGridDim<3>(options);
+}
+
+// cohesion/alignment sums over the wide cohesion_radius: exact vs tree and grid cell sums,
+// COLLISION_AVOID forces on the default spawn (nearly all pairs within the radius)
+// error: largest and rms deviation of the forces from exact, relative to the rms force
+template <int d>
+void benchWideDim(const BenchOptions& options)
+{
+    typedef Matrix<T, d, Eigen::Dynamic> Stack;
+    struct Config
+    {
+        const char* label;
+        bool grid;
+        int wide_sums;
+        T theta;
+        int sum_cells;
+        bool exact_boundary;
+    };
+    const Config configs[] = {
+        {"all pairs", false, EXACT_SUMS, 0, 0, true}, {"grid", true, EXACT_SUMS, 0, 0, true},
+        {"tree theta 0", true, TREE_SUMS, 0, 0, true}, {"tree theta 0.3", true, TREE_SUMS, 0.3f, 0, true},
+        {"tree theta 0.6", true, TREE_SUMS, 0.6f, 0, true}, {"tree theta 1", true, TREE_SUMS, 1, 0, true},
+        {"cells 2, exact boundary", true, CELL_SUMS, 0, 2, true}, {"cells 4, exact boundary", true, CELL_SUMS, 0, 4, true},
+        {"cells 8, exact boundary", true, CELL_SUMS, 0, 8, true}, {"cells 4, center of mass", true, CELL_SUMS, 0, 4, false},
+        {"cells 8, center of mass", true, CELL_SUMS, 0, 8, false}, {"cells 16, center of mass", true, CELL_SUMS, 0, 16, false}};
+    std::cout<<"== wide sums, COLLISION_AVOID, "<<d<<"d, per boid and step"<<'\n';
+    BenchOptions row = options;
+    row.perf = false;
+    printHeader(row, "     max err     rms err");
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        Stack exact_acc;
+        for(const Config& config : configs)
+        {
+            BoidsParams<T, d> params;
+            params.neighbor_grid = config.grid;
+            params.wide_sums = config.wide_sums;
+            params.theta = config.theta;
+            params.sum_cells = config.sum_cells;
+            params.exact_boundary = config.exact_boundary;
+            Boids<T, d> boids(n, params);
+            spawn(boids, COLLISION_AVOID);
+            Stack pos = boids.getPositions();
+            Stack vel = boids.getVelocities();
+            Stack acc = boids.getAcc(COLLISION_AVOID, pos, vel);
+            if(exact_acc.size() == 0) exact_acc = acc;
+            T scale = std::sqrt(exact_acc.squaredNorm()/n);
+            std::ostringstream error;
+            error<<std::scientific<<std::setprecision(2)
+                 <<std::setw(12)<<(acc-exact_acc).colwise().norm().maxCoeff()/scale
+                 <<std::setw(12)<<std::sqrt((acc-exact_acc).squaredNorm()/n)/scale;
+            measure(config.label, n, reps, row, [&]() {
+                volatile T sink = boids.getAcc(COLLISION_AVOID, pos, vel)(0, 0);
+                (void)sink;
+            }, error.str());
+        }
+    }
+}
+
+void benchWide(const BenchOptions& options)
+{
+    benchWideDim<2>(options);
+    benchWideDim<3>(options);
+}
+
+// K random circles and squares in [-1.5,1.5]^2
+std::vector<Obstacle<T>> randomObstacles(int count, std::mt19937& rng)
+{
+    std::uniform_real_distribution<T> place(-1.5, 1.5), size(0.02, 0.06);
+    std::vector<Obstacle<T>> obstacles(count);
+    for(int k=0;k<count;k++)
+    {
+        obstacles[k].center = Vector<T, 2>(place(rng), place(rng));
+        T r = size(rng);
+        if(k%2 == 0) obstacles[k].radius = r;
+        else obstacles[k].vertices = {Vector<T, 2>(-r, -r), Vector<T, 2>(r, -r), Vector<T, 2>(r, r), Vector<T, 2>(-r, r)};
+    }
+    return obstacles;
+}
+
+// distance to K obstacles: one field lookup vs testing every obstacle, and the cost of moving one
+void benchObstacles()
+{
+    const T cell = 0.01, band = 0.2;
+    const int queries = 4096;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<T> place(-1.5, 1.5);
+    std::vector<Vector<T, 2>> points(queries);
+    for(Vector<T, 2>& p : points) p = Vector<T, 2>(place(rng), place(rng));
+
+    std::cout<<"== obstacle distance field, cell "<<cell<<", band "<<band<<", per query"<<'\n';
+    std::cout<<std::left<<std::setw(12)<<"obstacles"<<std::right<<std::setw(14)<<"direct ns"<<std::setw(14)<<"field ns"
+             <<std::setw(14)<<"max error"<<std::setw(14)<<"build ms"<<std::setw(14)<<"move ms"<<std::setw(16)<<"nodes per move"<<'\n';
+    for(int count : {1, 10, 100, 500})
+    {
+        std::vector<Obstacle<T>> obstacles = randomObstacles(count, rng);
+        auto direct = [&](const Vector<T, 2>& p) {
+            T d = band;
+            for(const Obstacle<T>& obstacle : obstacles) d = std::min(d, obstacle.signedDistance(p));
+            return d;
+        };
+        ObstacleField<T> field;
+        auto start = Clock::now();
+        field.build(obstacles, cell, band);
+        double build_ms = msSince(start);
+
+        T sink = 0, max_error = 0;
+        start = Clock::now();
+        for(const Vector<T, 2>& p : points) sink += direct(p);
+        double direct_ns = 1e6*msSince(start)/queries;
+        start = Clock::now();
+        for(const Vector<T, 2>& p : points)
+        {
+            T d;
+            Vector<T, 2> gradient;
+            if(field.sample(p, d, gradient)) sink += d;
+        }
+        double field_ns = 1e6*msSince(start)/queries;
+        for(const Vector<T, 2>& p : points)
+        {
+            T d;
+            Vector<T, 2> gradient;
+            if(field.sample(p, d, gradient) && d < band - cell) max_error = std::max(max_error, std::abs(d-direct(p)));
+        }
+
+        // every obstacle steps a little, one at a time
+        long long nodes_before = field.updated_nodes;
+        start = Clock::now();
+        for(int k=0;k<count;k++) field.move(k, obstacles[k].center + Vector<T, 2>(0.01, 0.005));
+        double move_ms = msSince(start)/count;
+        volatile T keep = sink;
+        (void)keep;
+        std::cout<<std::left<<std::setw(12)<<count<<std::right<<std::fixed<<std::setprecision(2)<<std::setw(14)<<direct_ns<<std::setw(14)<<field_ns
+                 <<std::setprecision(4)<<std::setw(14)<<max_error<<std::setprecision(3)<<std::setw(14)<<build_ms<<std::setw(14)<<move_ms
+                 <<std::setw(16)<<(field.updated_nodes-nodes_before)/count<<'\n';
+        resetFormat();
+    }
+}
+
+// goal flow field around K obstacles: full transform vs repairing it after moving one obstacle
+// (the flow_repair test checks the repaired field against a fresh transform)
+void benchFlow()
+{
+    const T extent = 1.5, clearance = 0.03, band = 0.1;
+    const Vector<T, 2> goal(-1.4, -1.4);
+    std::mt19937 rng(2);
+    std::cout<<"== goal flow field over [-"<<extent<<","<<extent<<"]^2, clearance "<<clearance<<'\n';
+    std::cout<<std::left<<std::setw(12)<<"obstacles"<<std::right<<std::setw(8)<<"cell"<<std::setw(10)<<"nodes"<<std::setw(14)<<"build ms"
+             <<std::setw(14)<<"update ms"<<std::setw(16)<<"nodes/update"<<'\n';
+    for(int count : {10, 100})
+    {
+        for(T cell : {T(0.02), T(0.01)})
+        {
+            std::vector<Obstacle<T>> obstacles = randomObstacles(count, rng);
+            for(Obstacle<T>& obstacle : obstacles)
+                if((obstacle.center-goal).norm() < 0.3) obstacle.center += Vector<T, 2>(0.5, 0.5); // keep the goal reachable
+            ObstacleField<T> field;
+            field.build(obstacles, cell, band);
+            auto distance = [&](const Vector<T, 2>& p) {
+                T d;
+                Vector<T, 2> gradient;
+                return field.sample(p, d, gradient) ? d : band;
+            };
+            FlowField<T> flow;
+            auto start = Clock::now();
+            flow.build(goal, extent, cell, clearance, distance);
+            double build_ms = msSince(start);
+
+            // every obstacle jumps a bit, the flow field is repaired after each jump
+            std::uniform_real_distribution<T> jump(-0.1, 0.1);
+            long long relaxed_before = flow.relaxed;
+            start = Clock::now();
+            for(int k=0;k<count;k++)
+            {
+                Vector<T, 2> old_lo, old_hi, lo, hi;
+                obstacles[k].bounds(old_lo, old_hi);
+                obstacles[k].center += Vector<T, 2>(jump(rng), jump(rng));
+                obstacles[k].bounds(lo, hi);
+                // the bilinear lookup spreads the change of the distance by one field cell
+                if(field.move(k, obstacles[k].center))
+                    flow.update(old_lo.cwiseMin(lo).array()-cell, old_hi.cwiseMax(hi).array()+cell, distance);
+                else
+                    flow.build(goal, extent, cell, clearance, distance); // the obstacle field grew, every distance changed
+            }
+            double update_ms = msSince(start)/count;
+            std::cout<<std::left<<std::setw(12)<<count<<std::right<<std::setw(8)<<cell<<std::setw(10)<<flow.nodeCount()
+                     <<std::fixed<<std::setprecision(3)<<std::setw(14)<<build_ms<<std::setw(14)<<update_ms
+                     <<std::setw(16)<<(flow.relaxed-relaxed_before)/count<<'\n';
+            resetFormat();
+        }
+    }
+}
+
+// LEADER steps with one leader (all pairs) vs K follow groups, serial and on a thread pool
+void benchLeaders(const BenchOptions& options)
+{
+    const int steps = 200;
+    ThreadPool pool;
+    for(int n : options.sizes)
+    {
+        std::cout<<"== leader groups, LEADER, "<<n<<" boids, "<<steps<<" steps"<<'\n';
+        std::cout<<std::left<<std::setw(10)<<"leaders"<<std::right<<std::setw(10)<<"threads"<<std::setw(14)<<"ms/step"
+                 <<std::setw(14)<<"regrouped"<<std::setw(16)<<"largest group"<<'\n';
+        for(int leaders : {1, 8, 32})
+        {
+            for(int run=0;run<2;run++)
+            {
+                const int threads = run == 0 ? 1 : pool.size();
+                if(run == 1 && (leaders == 1 || threads == 1)) continue; // nothing to spread, or no second thread
+                BoidsParams<T, dim> params;
+                params.leaders = leaders;
+                Boids<T, dim> boids(n, params);
+                if(threads > 1) boids.setThreadPool(&pool);
+                spawn(boids, LEADER);
+                boids.getMousePos(TV::Ones());
+                double ms = timeSteps(boids, LEADER, steps);
+                const std::vector<int>& group_start = boids.getGroupStart();
+                int largest = n-1;
+                if(!group_start.empty())
+                {
+                    largest = 0;
+                    for(size_t g=0;g+1<group_start.size();g++) largest = std::max(largest, group_start[g+1]-group_start[g]);
+                }
+                std::cout<<std::left<<std::setw(10)<<leaders<<std::right<<std::setw(10)<<threads
+                         <<std::setw(14)<<std::fixed<<std::setprecision(3)<<ms/steps<<std::setw(14)<<boids.getRegrouped()
+                         <<std::setw(16)<<largest<<'\n';
+                resetFormat();
+            }
+        }
+    }
+}
+
+// bulk flock in a periodic box of 100 boids per unit area, the box grows with n: SEPARATION forces
+// with all pairs vs the wrapping grid (the neighbor_grid test checks them and the minimum image)
+void benchPeriodic(const BenchOptions& options)
+{
+    std::cout<<"== periodic box, SEPARATION, 100 boids per unit area, per boid and step"<<'\n';
+    printHeader(options);
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        BoidsParams<T, dim> params;
+        params.periodic = true;
+        params.period = std::sqrt(n/100.);
+        params.cohesion_radius = 0.2;
+        for(int use_grid=0;use_grid<2;use_grid++)
+        {
+            params.neighbor_grid = use_grid;
+            Boids<T, dim> boids(n, params);
+            spawn(boids, SEPARATION);
+            measureAcc(use_grid ? "grid" : "all pairs", n, reps, options, boids, SEPARATION, boids.getPositions());
+        }
+    }
+}
+
+// one breeding pass of a CA_BEHAVE team: the pairwise loop it replaced vs the grid and chunked pass
+// on 1 and 4 threads (the breed test checks they give the same children)
+void benchBreed(const BenchOptions& options)
+{
+    ThreadPool pool(4);
+    std::cout<<"== breeding, one CA_BEHAVE team, per parent"<<'\n';
+    printHeader(options);
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        BoidsParams<T, dim> params;
+        Boids<T, dim> boids(2*n, params);
+        spawn(boids, CA_BEHAVE);
+        const TVStack pos = boids.get_A_pos(), vel = boids.get_A_vel();
+        TVStack bred_pos, bred_vel;
+        measure("all pairs", n, reps, options, [&]() {
+            bred_pos = pos;
+            bred_vel = vel;
+            for(int i=0;i<n-1;i++)
+            {
+                for(int j=i+1;j<n;j++)
+                {
+                    if((pos.col(i)-pos.col(j)).norm() >= params.breed_range) continue;
+                    bred_pos.conservativeResize(dim, bred_pos.cols()+1);
+                    bred_pos.col(bred_pos.cols()-1) = (pos.col(i) + pos.col(j))/2;
+                    bred_vel.conservativeResize(dim, bred_vel.cols()+1);
+                    bred_vel.col(bred_vel.cols()-1) = (vel.col(i) + vel.col(j))/2;
+                }
+            }
+        });
+        for(int threads : {1, 4})
+        {
+            boids.setThreadPool(threads > 1 ? &pool : nullptr);
+            measure("grid, " + std::to_string(threads) + " thread" + (threads > 1 ? "s" : ""), n, reps, options, [&]() {
+                bred_pos = pos;
+                bred_vel = vel;
+                boids.breed(bred_pos, bred_vel);
+            });
+        }
+    }
+}
+
+// long CA_BEHAVE battle with frequent breeding, without and with a population cap: the peak
+// columns of the team matrices (their memory) and the time per step
+void benchPopulation(const BenchOptions& options)
+{
+    const int steps = 4000;
+    for(int n : options.sizes)
+    {
+        std::cout<<"== population cap, CA_BEHAVE, "<<n<<" boids, breed_gap 100, "<<steps<<" steps"<<'\n';
+        std::cout<<std::left<<std::setw(10)<<"cap"<<std::right<<std::setw(12)<<"ms/step"<<std::setw(14)<<"peak columns"
+                 <<std::setw(14)<<"peak bytes"<<std::setw(12)<<"final A:B"<<'\n';
+        for(int cap : {0, n, n/2})
+        {
+            BoidsParams<T, dim> params;
+            params.verbose = false;
+            params.breed_gap = 100;
+            params.population_cap = cap;
+            Boids<T, dim> boids(n, params);
+            spawn(boids, CA_BEHAVE);
+            int peak = boids.getTeamColumns();
+            auto start = Clock::now();
+            for(int s=0;s<steps && !boids.isDecided();s++)
+            {
+                boids.updateBehavior(CA_BEHAVE);
+                peak = std::max(peak, boids.getTeamColumns());
+            }
+            double ms = msSince(start);
+            std::cout<<std::left<<std::setw(10)<<(cap > 0 ? std::to_string(cap) : "none")<<std::right
+                     <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms/std::max(boids.getStep(), 1)
+                     <<std::setw(14)<<peak<<std::setw(14)<<2*peak*dim*sizeof(T)
+                     <<std::setw(12)<<(std::to_string(boids.get_A_count()) + ":" + std::to_string(boids.get_B_count()))<<'\n';
+            resetFormat();
+        }
+    }
+}
+
+// bulk flock of 100 boids per unit area, SEPARATION forces on the grid reading the neighbors in float
+// (sorted coordinates, then position and velocity by index) vs the 16-bit copy of compact_storage.
+// bytes: what the pair loop reads per neighbor, the sorted order included; errors relative to the
+// rms force. The memory traffic only dominates from about 100k boids: bench compact --n 10000,100000,1000000
+void benchCompact(const BenchOptions& options)
+{
+    std::cout<<"== compact storage, SEPARATION on the grid, 100 boids per unit area, per boid and step"<<'\n';
+    printHeader(options, "   bytes     max err     rms err");
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        BoidsParams<T, dim> params;
+        params.neighbor_grid = true;
+        params.cohesion_radius = 0.2;
+        TVStack float_acc;
+        for(int compact=0;compact<2;compact++)
+        {
+            params.compact_storage = compact;
+            Boids<T, dim> boids(n, params);
+            spawn(boids, SEPARATION);
+            TVStack pos = boids.getPositions()*T(std::sqrt(n/100.));
+            const TVStack acc = boids.getAcc(SEPARATION, pos);
+            if(!compact) float_acc = acc;
+            const int bytes = int(sizeof(int)) + (compact ? 2*dim*int(sizeof(int16_t)) : 3*dim*int(sizeof(T)));
+            const T rms = std::sqrt(float_acc.squaredNorm()/n);
+            std::ostringstream suffix;
+            suffix<<std::setw(8)<<bytes<<std::scientific<<std::setprecision(2)
+                  <<std::setw(12)<<(acc-float_acc).colwise().norm().maxCoeff()/rms
+                  <<std::setw(12)<<std::sqrt((acc-float_acc).squaredNorm()/n)/rms;
+            measureAcc(compact ? "16-bit neighbors" : "float neighbors", n, reps, options, boids, SEPARATION, pos, suffix.str());
+        }
+    }
+}
+
+// force kernels of Scalar against float, the deterministic fixed32 (fixed_point.h) or double
+template <class Scalar>
+void benchScalar(const BenchOptions& options, const std::string& name)
+{
+    printHeader(options);
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, double(n)*n);
+        for(MethodTypes type : {COHESION, SEPARATION, COLLISION_AVOID, LEADER})
+        {
+            Boids<T, dim> boids(n);
+            spawn(boids, type);
+            measureAcc(std::string("float ") + methodName(type), n, reps, options, boids, type, boids.getPositions());
+            Boids<Scalar, dim> scalar_boids(n);
+            spawn(scalar_boids, type);
+            measureAcc(name + " " + methodName(type), n, reps, options, scalar_boids, type, scalar_boids.getPositions());
+        }
+    }
+}
+
+// the deterministic mode, Boids<fixed32, dim>: the lockstep test (src/tests) checks the state hashes
+void benchFixed(const BenchOptions& options)
+{
+    std::cout<<"== fixed32 against float, per boid and step"<<'\n';
+    benchScalar<fixed32>(options, "fixed32");
+}
+
+// CIRCULAR_MOTION with RK4 over many orbits in Scalar, max distance to the exact orbit
+template <class Scalar>
+double orbitError(int n, double h, int orbits, double& ms)
+{
+    BoidsParams<Scalar, dim> params;
+    params.updateMode = RK4;
+    const int steps = int(std::lround(2*M_PI*orbits/h));
+    params.h = Scalar(2*M_PI*orbits/steps);
+    Boids<Scalar, dim> boids(n, params);
+    spawn(boids, CIRCULAR_MOTION);
+    const Matrix<Scalar, dim, Eigen::Dynamic> x0 = boids.getPositions(), v0 = boids.getVelocities();
+    ms = timeSteps(boids, CIRCULAR_MOTION, steps);
+    const double t = double(steps)*double(params.h);
+    const Matrix<double, dim, Eigen::Dynamic> exact = x0.template cast<double>()*std::cos(t) + v0.template cast<double>()*std::sin(t);
+    return (boids.getPositions().template cast<double>() - exact).colwise().norm().maxCoeff();
+}
+
+// float against double (the "precision" of a scenario file): force kernels, then the error
+// of long RK4 orbits, where float rounding piles up and double stays at the truncation error
+void benchPrecision(const BenchOptions& options)
+{
+    std::cout<<"== float against double, per boid and step"<<'\n';
+    benchScalar<double>(options, "double");
+
+    const int n = options.sizes.front();
+    const double h = 0.005;
+    std::cout<<"== RK4 orbits, CIRCULAR_MOTION, "<<n<<" boids, h "<<h<<'\n';
+    std::cout<<std::left<<std::setw(20)<<"precision"<<std::right<<std::setw(10)<<"orbits"
+             <<std::setw(12)<<"ms"<<std::setw(14)<<"max error"<<'\n';
+    for(int orbits : {1, 10, 100})
+    {
+        for(int precision=0;precision<2;precision++)
+        {
+            double ms;
+            const double error = precision ? orbitError<double>(n, h, orbits, ms) : orbitError<T>(n, h, orbits, ms);
+            std::cout<<std::left<<std::setw(20)<<(precision ? "double" : "float")<<std::right<<std::setw(10)<<orbits
+                     <<std::setw(12)<<std::fixed<<std::setprecision(3)<<ms
+                     <<std::setw(14)<<std::scientific<<std::setprecision(2)<<error<<'\n';
+            resetFormat();
+        }
+    }
+}
+
+// publication to shared memory (shared_state.h): a frame written and read in place, per boid;
+// the shared_state test checks that a reader racing the writer never gets a torn frame
+void benchShared(const BenchOptions& options)
+{
+    std::cout<<"== shared memory publication, per boid and frame"<<'\n';
+    printHeader(options);
+    const std::string name = "boids_bench";
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, n);
+        SharedStatePublisher<T, dim> publisher;
+        publisher.open(name, n);
+        SharedStateReader<T, dim> reader;
+        reader.open(name);
+        TVStack pos = TVStack::Random(dim, n), vel = TVStack::Random(dim, n);
+        uint64_t step = 0;
+        measure("publish", n, reps, options, [&]() {
+            publisher.publish(pos, vel, step++, 0);
+        });
+        measure("read in place", n, reps, options, [&]() {
+            reader.read([](const SharedStateReader<T, dim>::StackMap& p, const SharedStateReader<T, dim>::StackMap& v, const SharedFrame&) {
+                volatile T sink = p.sum() + v.sum();
+                (void)sink;
+            });
+        });
+    }
+}
+
+// streaming to viewers (stream.h): a frame encoded and decoded per boid, its bytes against raw
+// positions and the error of the 16-bit coordinates relative to the flock's extent (the
+// stream_frames test bounds it); then a viewer that never reads: broadcasting must stay as fast,
+// its frames are dropped
+void benchStream(const BenchOptions& options)
+{
+    std::cout<<"== stream frames, per boid and frame"<<'\n';
+    printHeader(options, "   bytes     max err");
+    for(int n : options.sizes)
+    {
+        int reps = repsFor(options, n);
+        Boids<T, dim> boids(n);
+        spawn(boids, COLLISION_AVOID);
+        const TVStack pos = boids.getPositions();
+        std::string message;
+        encodeFrame(pos, COLLISION_AVOID, 0, 0, 0, message);
+        TVStack decoded;
+        StreamFrameInfo info;
+        decodeFrame(message, decoded, info);
+        const T extent = (pos.rowwise().maxCoeff() - pos.rowwise().minCoeff()).maxCoeff();
+        std::ostringstream suffix;
+        suffix<<std::setw(8)<<std::setprecision(2)<<double(message.size())/n<<std::scientific<<std::setw(12)<<(decoded-pos).cwiseAbs().maxCoeff()/extent;
+        measure("encode", n, reps, options, [&]() {
+            encodeFrame(pos, COLLISION_AVOID, 0, 0, 0, message);
+        }, suffix.str());
+        std::ostringstream raw;
+        raw<<std::setw(8)<<sizeof(T)*dim;
+        measure("decode", n, reps, options, [&]() {
+            decodeFrame(message, decoded, info);
+        }, raw.str());
+    }
+
+    const int n = options.sizes.back(), frames = 200;
+    const std::string address = "unix:/tmp/boids_bench.sock";
+    StreamServer server;
+    server.listen(address);
+    StreamClient stalled;
+    stalled.connect(address);
+    std::vector<std::string> commands;
+    server.poll(commands);
+    TVStack pos = TVStack::Random(dim, n);
+    std::string message;
+    double slowest = 0;
+    for(int f=0;f<frames;f++)
+    {
+        auto start = Clock::now();
+        encodeFrame(pos, COLLISION_AVOID, f, 0, 0, message);
+        server.broadcast(message);
+        server.poll(commands);
+        slowest = std::max(slowest, msSince(start));
+    }
+    std::cout<<n<<" boids to a viewer that never reads: "<<frames<<" frames, "<<server.sent<<" sent, "<<server.dropped
+             <<" dropped, slowest broadcast "<<slowest<<" ms"<<'\n';
+}
+
+std::vector<int> parseSizes(const char* list)
+{
+    std::vector<int> sizes;
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ',')) sizes.push_back(atoi(item.c_str()));
+    return sizes;
+}
+
+struct BenchSection
+{
+    const char* name;
+    std::function<void(const BenchOptions&)> run;
+};
+
+// every section, in the order of the usage
+const std::vector<BenchSection>& benchSections()
+{
+    static const std::vector<BenchSection> sections = {
+        {"kernels", benchKernels}, {"integrators", benchIntegrators}, {"implicit", benchImplicit},
+        {"sleeping", benchSleeping}, {"grid", benchGrid}, {"wide", benchWide},
+        {"obstacles", [](const BenchOptions&) { benchObstacles(); }}, {"flow", [](const BenchOptions&) { benchFlow(); }},
+        {"leaders", benchLeaders}, {"periodic", benchPeriodic}, {"breed", benchBreed},
+        {"population", benchPopulation}, {"compact", benchCompact}, {"fixed", benchFixed},
+        {"precision", benchPrecision}, {"shared", benchShared}, {"stream", benchStream}};
+    return sections;
+}
+
+void printUsage()
+{
+    std::cout<<"usage: bench [section...] [--n 40,400,1000] [--reps R] [--perf]"<<'\n';
+    std::cout<<"sections:";
+    for(const BenchSection& section : benchSections()) std::cout<<' '<<section.name;
+    std::cout<<'\n';
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    std::vector<std::string> sections;
+    for(int i=1;i<argc;i++)
+    {
+        if(!strcmp(argv[i], "--n") && i+1 < argc) options.sizes = parseSizes(argv[++i]);
+        else if(!strcmp(argv[i], "--reps") && i+1 < argc) options.reps = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--perf")) options.perf = true;
+        else if(argv[i][0] != '-') sections.push_back(argv[i]);
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if(sections.empty()) sections.push_back("kernels");
+    // every name is checked before the first section runs
+    std::vector<const BenchSection*> runs;
+    for(const std::string& name : sections)
+    {
+        auto it = std::find_if(benchSections().begin(), benchSections().end(),
+                               [&](const BenchSection& section) { return name == section.name; });
+        if(it == benchSections().end())
+        {
+            std::cout<<"unknown section "<<name<<'\n';
+            printUsage();
+            return 1;
+        }
+        runs.push_back(&*it);
+    }
+    if(options.perf && !PerfCounters::thisThread().available())
+        std::cout<<"perf counters unavailable (check /proc/sys/kernel/perf_event_paranoid)"<<'\n';
+
+    for(const BenchSection* section : runs) section->run(options);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <Eigen/Core>
+
+// Barnes-Hut tree (quadtree in 2d, octree in 3d) for the wide-radius
+// cohesion/alignment sums: the sum of the positions and velocities of all
+// boids within radius of a boid, and their count. Every node stores these
+// sums for its boids and the tight bounding box of them.
+// A query takes a node whole when its box lies inside the radius and skips it
+// when the box lies outside, both exact. A node that straddles the radius is
+// opened, unless it is small seen from the boid (box size < theta * distance
+// to its center of mass): then it is taken whole if its center of mass lies
+// within the radius and dropped otherwise. theta = 0 is exact.
+
+template <class T, int dim>
+class BarnesHutTree
+{
+public:
+    typedef Eigen::Matrix<T, dim, 1> TV;
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+
+    static constexpr int leaf_size = 8;   // boids a leaf may hold
+    static constexpr int max_depth = 24;  // coincident boids end up in one leaf
+    static constexpr int children = 1 << dim;
+
+    // live: only the boids marked there are in the tree (slot pools)
+    void build(const TVStack& pos, const TVStack& vel, const std::vector<char>* live = nullptr)
+    {
+        const int n = int(pos.cols());
+        nodes.clear();
+        order.clear();
+        slot_of.assign(n, -1);
+        scratch.resize(n);
+        for(int i=0;i<n;i++)
+            if(!live || (*live)[i]) order.push_back(i);
+        const int m = int(order.size());
+        if(m == 0) return;
+        nodes.emplace_back();
+        buildNode(pos, vel, 0, 0, m, 0);
+        for(int k=0;k<m;k++) slot_of[order[k]] = k;
+    }
+
+    // sums over the boids j != i within radius of boid i (at p = pos.col(i)), i in the tree
+    void sums(const TVStack& pos, const TVStack& vel, int i, T radius, T theta, TV& pos_sum, TV& vel_sum, int& count) const
+    {
+        pos_sum.setZero();
+        vel_sum.setZero();
+        count = 0;
+        if(nodes.empty()) return;
+        const TV p = pos.col(i);
+        const T r2 = radius*radius;
+        const int slot = slot_of[i];
+        int stack[max_depth*children + 1];
+        int top = 0;
+        stack[top++] = 0;
+        while(top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            // squared distances to the nearest and farthest point of the box
+            T near2 = 0, far2 = 0;
+            using std::abs;
+            for(int d=0;d<dim;d++)
+            {
+                T below = node.lo[d]-p[d], above = p[d]-node.hi[d];
+                T gap = std::max(std::max(below, above), T(0));
+                T reach = std::max(abs(p[d]-node.lo[d]), abs(p[d]-node.hi[d]));
+                near2 += gap*gap;
+                far2 += reach*reach;
+            }
+            if(near2 > r2) continue;
+            const bool holds_i = slot >= node.begin && slot < node.end;
+            if(far2 <= r2)
+            {
+                pos_sum += node.pos_sum;
+                vel_sum += node.vel_sum;
+                count += node.end-node.begin;
+                if(holds_i)
+                {
+                    pos_sum -= p;
+                    vel_sum -= vel.col(i);
+                    count--;
+                }
+                continue;
+            }
+            if(node.first_child < 0)
+            {
+                for(int k=node.begin;k<node.end;k++)
+                {
+                    int j = order[k];
+                    if(j == i || (pos.col(j)-p).squaredNorm() > r2) continue;
+                    pos_sum += pos.col(j);
+                    vel_sum += vel.col(j);
+                    count++;
+                }
+                continue;
+            }
+            if(!holds_i && theta > 0)
+            {
+                const int m = node.end-node.begin;
+                const TV center = node.pos_sum/T(m);
+                const T size = (node.hi-node.lo).maxCoeff();
+                const T dist2 = (center-p).squaredNorm();
+                if(size*size < theta*theta*dist2)
+                {
+                    if(dist2 <= r2)
+                    {
+                        pos_sum += node.pos_sum;
+                        vel_sum += node.vel_sum;
+                        count += m;
+                    }
+                    continue;
+                }
+            }
+            for(int c=0;c<node.child_count;c++) stack[top++] = node.first_child+c;
+        }
+    }
+
+    int nodeCount() const { return int(nodes.size()); }
+
+private:
+    struct Node
+    {
+        TV lo, hi;             // tight bounding box of the boids
+        TV pos_sum, vel_sum;
+        int begin = 0, end = 0; // boids order[begin..end)
+        int first_child = -1;   // children are stored next to each other, -1 for a leaf
+        int child_count = 0;
+    };
+
+    // fills nodes[id], the slot is reserved by the caller
+    void buildNode(const TVStack& pos, const TVStack& vel, int id, int begin, int end, int depth)
+    {
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        node.lo = node.hi = pos.col(order[begin]);
+        node.pos_sum.setZero();
+        node.vel_sum.setZero();
+        for(int k=begin;k<end;k++)
+        {
+            int j = order[k];
+            node.lo = node.lo.cwiseMin(pos.col(j));
+            node.hi = node.hi.cwiseMax(pos.col(j));
+            node.pos_sum += pos.col(j);
+            node.vel_sum += vel.col(j);
+        }
+        const bool split = end-begin > leaf_size && depth < max_depth && (node.hi-node.lo).maxCoeff() > 0
+            && node.lo.allFinite() && node.hi.allFinite();
+        if(split)
+        {
+            // counting sort of the boids into the 2^dim octants around the box center
+            const TV mid = (node.lo+node.hi)/T(2);
+            auto octant = [&](int j) {
+                int c = 0;
+                for(int d=0;d<dim;d++) if(pos(d, j) > mid[d]) c |= 1 << d;
+                return c;
+            };
+            int start[children + 1] = {};
+            for(int k=begin;k<end;k++) start[octant(order[k]) + 1]++;
+            for(int c=0;c<children;c++) start[c+1] += start[c];
+            int fill[children];
+            for(int c=0;c<children;c++) fill[c] = begin + start[c];
+            for(int k=begin;k<end;k++) scratch[fill[octant(order[k])]++] = order[k];
+            std::copy(scratch.begin()+begin, scratch.begin()+end, order.begin()+begin);
+
+            // reserve the children next to each other, then build them depth first
+            int ranges[children][2];
+            for(int c=0;c<children;c++)
+            {
+                if(start[c] == start[c+1]) continue;
+                ranges[node.child_count][0] = begin + start[c];
+                ranges[node.child_count][1] = begin + start[c+1];
+                node.child_count++;
+            }
+            node.first_child = int(nodes.size());
+            nodes.resize(nodes.size() + node.child_count);
+            for(int c=0;c<node.child_count;c++)
+                buildNode(pos, vel, node.first_child+c, ranges[c][0], ranges[c][1], depth+1);
+        }
+        nodes[id] = node; // by index, building the children may have moved nodes
+    }
+
+    std::vector<Node> nodes;
+    std::vector<int> order;   // boids sorted so every node is a contiguous range
+    std::vector<int> slot_of; // position of every boid in order
+    std::vector<int> scratch;
+};
+#endif
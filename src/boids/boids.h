@@ -1,23 +1,135 @@
 #ifndef BOIDS_H
 #define BOIDS_H
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
 #include <Eigen/Core>
 #include <Eigen/QR>
 #include <Eigen/Sparse>
+#include "profiler.h"
+#include "thread_pool.h"
 template <typename T, int dim>
 using Vector = Eigen::Matrix<T, dim, 1, 0, dim, 1>;
 
 template <typename T, int n, int m>
 using Matrix = Eigen::Matrix<T, n, m, 0, n, m>;
 
+#include "integrators.h"
+#include "implicit_repulsion.h"
+#include "spatial_grid.h"
+#include "barnes_hut.h"
+#include "obstacle_field.h"
+#include "flow_field.h"
+#include "periodic.h"
+#include "slot_pool.h"
+#include "fixed_point.h"
+
 // Define methods here
 enum MethodTypes
 {
     FREEFALL=0, CIRCULAR_MOTION=1, COHESION=2, ALIGNMENT=3, SEPARATION=4, COLLISION_AVOID=5, LEADER=6, CA_BEHAVE=7
 };
 
+// how the cohesion/alignment sums over cohesion_radius are computed
+enum WideSums
+{
+    EXACT_SUMS=0, TREE_SUMS=1, CELL_SUMS=2
+};
+
+// vector with x and y set and every other axis zero
+template <class T, int dim>
+Vector<T, dim> planarVector(T x, T y)
+{
+    Vector<T, dim> v = Vector<T, dim>::Zero();
+    v[0] = x;
+    v[1] = y;
+    return v;
+}
+
+// params configuration here!---------------------------------------
+// defaults below, every field can be overridden by a scenario file (see scenario.h)
+template <class T, int dim>
+struct BoidsParams
+{
+    typedef Vector<T, dim> TV;
+
+    T h = 0.0005;                    // the step size // speed of simulation
+    int updateMode = 1;              // 0 basic, 1 symplectic euler, 2 midpoint, 3 velocity verlet, 4 rk4, 5 adaptive, 6 multirate
+    T tolerance = 1e-4;              // adaptive: error allowed per step and component
+    T h_min = 1e-6;                  // adaptive: step size bounds, h is the first step
+    T h_max = 0.05;
+    bool adaptive_floor = true;      // adaptive: never below h, a try at h is taken over the tolerance (stiff phases cost 3 evaluations per h)
+    int respa_steps = 4;             // multirate: steps per cohesion/alignment evaluation
+    bool implicit_repulsion = false; // symplectic euler: solve the separation springs semi-implicitly, see implicit_repulsion.h
+    int cg_iterations = 10;          // implicit repulsion: conjugate gradient iterations and tolerance
+    T cg_tolerance = 1e-4;
+    bool sleeping = false;           // flocking methods: boids that stay calm stop moving until something moves nearby
+    T sleep_velocity = 0.15;         // calm: slower than this every step
+    int sleep_steps = 200;           // for this many steps in a row, then over those steps
+    T sleep_distance = 0.01;         // the boid moved less than this
+    T sleep_acc = 5;                 // and its velocity changed by less than sleep_acc*time (net force)
+    T wake_radius = 0.16;            // a sleeper wakes when an awake boid faster than 2*sleep_velocity comes this close
+    bool neighbor_grid = false;      // find neighbors in a uniform grid (spatial_grid.h) instead of testing all pairs
+    bool compact_storage = false;    // grid: the pair loops read 16-bit copies of the neighbors' positions and velocities, sums stay in T
+    int wide_sums = 0;               // cohesion/alignment sums: 0 exact, 1 barnes-hut tree (barnes_hut.h), 2 grid cell sums, repulsion stays exact
+    T theta = 0.5;                   // tree: opening angle, larger is faster and coarser, 0 exact
+    int sum_cells = 4;               // cell sums: grid cells per cohesion_radius, more cells -> fewer boids on the boundary
+    bool exact_boundary = true;      // cell sums: test the boids of the boundary cells, else count those cells by their center of mass
+    bool periodic = false;           // wrap around the box [-period/2, period/2)^dim, pair forces take the minimum image (periodic.h)
+    T period = 3.5;                  // side of the periodic box
+    
+    T cohesion_radius = 0.5;
+    T repel_radius = 0.08;
+    T ck = 10;                       // cohesion gain (pos drag)
+    T ak = 1;                        // alignment gain (vel drag)
+    T rk = 500;                      // seperation repel gain
+
+    T obs_radius = 0.2;              // obstacle radius
+    T eyesight_range = 1;            // if see obstacle, get repelled
+    T obs_effect_band = 0.2;         // repelled if too close
+    T ok = 10;                       // obstacle repel gain
+    T obs_repel_power = 0.5;         // repel power x^?
+    TV obs_pos = TV::Zero();         // obstacle position
+    std::vector<Obstacle<T>> obstacles; // many circles and polygons, replace obs_pos/obs_radius when not empty (obstacle_field.h)
+    T field_cell = 0.02;             // node spacing of their distance field
+
+    TV fixed_goal_pos = planarVector<T, dim>(-1.5,-0.5);  // fixed goal position
+    bool flow_field = false;            // steer to the goal along a flow field around the obstacles, shared by all boids (flow_field.h)
+    T flow_cell = 0.02;                 // flow field node spacing
+    T flow_extent = 2.5;                // it covers [-flow_extent, flow_extent]^2
+    T flow_clearance = 0.05;            // nodes closer than this to an obstacle are blocked
+    T max_drag = 20;                    // goal attraction force maximum
+    T gpk = 20;
+    T gdk = 8;                          // goal attraction D-gain
+
+    int leaders = 1;                    // LEADER: number of follow groups, leader 0 follows the mouse
+    T leader_spacing = 0.4;             // leader g > 0 follows leader (g-1)/2 at this distance
+    int regroup_steps = 50;             // every follower checks for a nearer leader once in this many steps
+
+    int breed_gap = 1000;
+    int population_cap = 0;             // CA_BEHAVE: most boids per team, 0 unlimited; capped teams live in fixed slot pools (slot_pool.h)
+    T bound_edge = 0.1;
+    T safe_edge = 1.75;
+    T bound_repel_acc = 500;
+    T breed_range = 0.09;               // slightly bigger than repel range
+    T death_range = 0.15;
+    T enemy_kill = 3;
+    T repel_death_ratio = 0.6;
+    T repel_num = 6;
+    int strategy = 3;                   // control strategy of team A (red), 0 = no control
+    bool verbose = true;                // print CA_BEHAVE population every step
+};
+// ----------------------------------------------------------------
+
 template <class T, int dim>
 class Boids
 {
+    static_assert(dim >= 2, "boids move at least in a plane");
     typedef Matrix<T, Eigen::Dynamic, 1> VectorXT;
     typedef Matrix<T, dim,Eigen::Dynamic> TVStack;
     typedef Vector<T, dim> TV;
@@ -28,56 +140,66 @@ private:
     TVStack velocities; // a matrix (dim * n)
     int n;
     bool update = false;
-    TV mouse_pos = TV(0,0);
+    TV mouse_pos = TV::Zero();
     TVStack A_pos, A_vel;
     TVStack B_pos, B_vel;
+    bool pooled = false;            // CA_BEHAVE with params.population_cap: the team matrices have cap columns,
+    SlotPool A_slots, B_slots;      // these mark the live ones
+    std::vector<int> dead_A, dead_B; // slots freed by the last attack
     int cnt = 0;
+    BoidsParams<T, dim> params;
+    IntegratorState<T, dim> integrator_state;
+    MethodTypes integrated_type = FREEFALL; // method the cached accelerations belong to
+    RepulsionSolver<T, dim> repulsion_solver;
+    std::vector<char> awake;        // per boid, sleeping boids are skipped by getAcc and keep zero velocity
+    std::vector<int> calm_steps;    // steps in a row below sleep_velocity
+    TVStack calm_pos, calm_vel;     // position and velocity where the calm steps began
+    int sleeping_count = 0;
+    SpatialGrid<T, dim> wake_grid;  // the boids that wake sleepers, rebuilt every step while any sleep
+    SpatialGrid<T, dim> grid;       // neighbors of the current force evaluation when params.neighbor_grid
+    bool use_grid = false;
+    BarnesHutTree<T, dim> tree;     // cohesion/alignment sums when params.wide_sums == TREE_SUMS
+    SpatialGrid<T, dim> sum_grid;   // and when CELL_SUMS
+    ObstacleField<T> obstacle_field; // params.obstacles, built on first use
+    bool field_valid = false;
+    FlowField<T> flow;               // params.flow_field, built on first use
+    bool flow_valid = false;
+    long long force_evals = 0; // getAcc calls of the integrators
+    long long wide_evals = 0;  // the ones that summed the cohesion/alignment neighbors
+    std::vector<int> group_start;   // LEADER with params.leaders > 1: columns 0..K-1 are the leaders, the
+                                    // followers of leader g are the columns group_start[g]..group_start[g+1]-1
+    int regroup_cursor = 0;         // next follower slot to check for a nearer leader
+    long long regrouped = 0;        // followers moved to another group
+    ThreadPool* pool = nullptr;     // runs the follow groups and the breeding in parallel when set, not owned
+    static constexpr int breed_chunk = 64; // boids per breeding job
+    SpatialGrid<T, dim> breed_grid;
+    std::vector<std::vector<std::pair<int, int>>> breed_pairs; // pairs (i, j) of every chunk
+    std::mt19937 rng;   // every instance has its own generator, so instances can run on different threads
 
-    // params configuration here!---------------------------------------
-    float h = 0.0005;                // the step size // speed of simulation
-    int updateMode = 1;              // updateMode = 0/1/other int
-    
-    float cohesion_radius = 0.5;
-    float repel_radius = 0.08;
-    float ck = 10;                   // cohesion gain (pos drag)
-    float ak = 1;                    // alignment gain (vel drag)
-    float rk = 500;                  // seperation repel gain
-
-    float obs_radius = 0.2;          // obstacle radius
-    float eyesight_range = 1;        // if see obstacle, get repelled
-    float obs_effect_band = 0.2;     // repelled if too close
-    float ok = 10;                   // obstacle repel gain
-    float obs_repel_power = 0.5;     // repel power x^?
-    TV obs_pos = TV(0, 0);           // obstacle position
-
-    TV fixed_goal_pos = TV(-1.5,-0.5);  // fixed goal position
-    float max_drag = 20;                // goal attraction force maximum
-    float gpk = 20;
-    float gdk = 8;                      // goal attraction D-gain
-
-    int breed_gap = 1000;
-    float bound_edge = 0.1;
-    float safe_edge = 1.75;
-    float bound_repel_acc = 500;
-    float breed_range = 0.09;           // slightly bigger than repel range
-    float death_range = 0.15;
-    float enemy_kill = 3;
-    float repel_death_ratio = 0.6;
-    float repel_num = 6;
-    // ----------------------------------------------------------------
+    // uniform number in [0,1), computed from the raw mt19937 output so every platform spawns the same boids
+    float uniform() {return (rng() >> 8) * (1.f/16777216.f);}
 
 public:
     Boids() :n(1) {}
     Boids(int n) :n(n) {initializePositions();}
+    Boids(int n, const BoidsParams<T, dim>& params) :n(n), params(params) {initializePositions();}
     ~Boids() {}
 
-    void setParticleNumber(int n) {n = n;}
+    void setParticleNumber(int n) {this->n = n;}
     int getParticleNumber() { return n; }
+    void setParams(const BoidsParams<T, dim>& params) {this->params = params; integrator_state.invalidate(); wakeAll(); field_valid = flow_valid = false;}
+    const BoidsParams<T, dim>& getParams() const { return params; }
+    void seed(unsigned int s) {rng.seed(s);}
 
     void initializePositions(MethodTypes type = FREEFALL)
     {
         // Basic Spawn
-        auto RAND = [&](T dummy) {return static_cast <T> (rand()) / static_cast <T> (RAND_MAX);};
+        auto RAND = [&](T dummy) {return static_cast <T> (uniform());};
+        cnt = 0;
+        pooled = false;
+        integrator_state = IntegratorState<T, dim>(); // cached accelerations belong to the old boids
+        force_evals = wide_evals = 0;
+        wakeAll();
         TVStack bias = TVStack::Ones(dim,n);
         positions = TVStack::Zero(dim, n).unaryExpr(RAND)- 0.5*bias; //randomly spawn position in [-0.5,0.5]*[-0.5,0.5]
         velocities = TVStack::Zero(dim, n); // basic initial velocity is 0
@@ -94,239 +216,292 @@ public:
         }
         else if (type == CA_BEHAVE)
         {
-            A_pos = TVStack::Zero(dim, int(n/2)).unaryExpr(RAND) + 0.5*bias;
-            B_pos = TVStack::Zero(dim, int(n/2)).unaryExpr(RAND) - 1.5*bias;
-            A_vel = B_vel = TVStack::Zero(dim, int(n/2)).unaryExpr(RAND) - 0.5*bias;
+            TVStack half_bias = TVStack::Ones(dim, int(n/2)); // each team has n/2 boids
+            A_pos = TVStack::Zero(dim, int(n/2)).unaryExpr(RAND) + 0.5*half_bias;
+            B_pos = TVStack::Zero(dim, int(n/2)).unaryExpr(RAND) - 1.5*half_bias;
+            A_vel = B_vel = TVStack::Zero(dim, int(n/2)).unaryExpr(RAND) - 0.5*half_bias;
+            pooled = params.population_cap > 0;
+            if(pooled)
+            {
+                allocatePool(A_pos, A_vel, A_slots);
+                allocatePool(B_pos, B_vel, B_slots);
+            }
         }
         else if(type != FREEFALL)
         {
             // for flocking behavior, randomly init velocities in [-0.5,0.5]*[-0.5,0.5]
             velocities = TVStack::Zero(dim, n).unaryExpr(RAND) - 0.5*bias;
         }
+        if(params.periodic && type != CA_BEHAVE)
+        {
+            // spread over the whole box, the bulk has no edges
+            positions = (positions.array() - positions.array().floor() - 0.5)*params.period;
+        }
+        group_start.clear();
+        regroup_cursor = 0;
+        regrouped = 0;
+        if(type == LEADER && params.leaders > 1) formGroups();
     }
 
 //Xupdate: update new position given pos and vel
     TVStack Xupdate(TVStack pos, TVStack vel, bool if_half_h = false)
     {
-        if(if_half_h) return pos + h/2*vel;
-        else return pos + h*vel;
+        PROFILE_SCOPE("integrate");
+        if(if_half_h) return pos + params.h/2*vel;
+        else return pos + params.h*vel;
     }
 //Vupdate: update new velocity given current velocity and acceleration
     TVStack Vupdate(TVStack vel, TVStack acc, bool if_half_h = false)
     {
-        if(if_half_h) return vel + h/2*acc;
-        else return vel + h*acc;
+        PROFILE_SCOPE("integrate");
+        if(if_half_h) return vel + params.h/2*acc;
+        else return vel + params.h*acc;
     }
 
 // -----------------------------------------------------------------------------------
 // getAcc: main function implement for this exercises
-// compute acceleration for each particle, given currentMethod and pos
-    TVStack getAcc(MethodTypes type, TVStack pos)
+// compute acceleration for each particle, given currentMethod, pos and the current velocities
+    TVStack getAcc(MethodTypes type, const TVStack& pos)
+    {
+        return getAcc(type, pos, velocities);
+    }
+// compute acceleration for each particle, given currentMethod, pos and vel (used by multi-stage integrators)
+// parts selects the wide-radius cohesion/alignment terms (SLOW_FORCES), the short-range REPULSION
+// and the obstacle, goal and damping terms (EXTERNAL_FORCES), see integrators.h
+    TVStack getAcc(MethodTypes type, const TVStack& pos, const TVStack& vel, ForceParts parts = ALL_FORCES)
+    {
+        if(params.periodic) return getAcc(type, pos, vel, parts, periodicBox());
+        return getAcc(type, pos, vel, parts, OpenBox<T, dim>());
+    }
+// the pair forces take the images of box (periodic.h)
+    template <class Box>
+    TVStack getAcc(MethodTypes type, const TVStack& pos, const TVStack& vel, ForceParts parts, const Box& box)
     {
+        PROFILE_SCOPE("forces");
         TVStack acc = TVStack::Zero(dim,n);
+        // radii and gain of the pair loops converted to T once, not per pair (fixed32)
+        const T cohesion_radius = params.cohesion_radius, repel_radius = params.repel_radius, rk = params.rk;
+        const bool slow = parts & SLOW_FORCES;
+        const bool repel = parts & REPULSION;
+        const bool external = parts & EXTERNAL_FORCES;
+        const bool skip_sleeping = params.sleeping && sleeping_count > 0 && int(awake.size()) == pos.cols();
         if(type == FREEFALL)
         {
-            acc.row(0) = TV::Zero();
-            acc.row(1) = 9.81*TV::Ones();
+            if(!external) return acc;
+            acc.row(1).setConstant(9.81); // gravity points down the screen
             return acc;
         }
         else if (type == CIRCULAR_MOTION)
         {
+            if(!external) return acc;
             return -pos;
         }
         else if (type == COHESION)
         {
+            if(!slow) return acc;
+            const bool approx = prepareWideSums(pos, vel);
+            if(!approx) prepareNeighbors(pos, vel, params.cohesion_radius);
             for(int i=0;i<n;i++)
             {
+                if(skip_sleeping && !awake[i]) continue;
                 TV neighbor_pos_sum = TV::Zero();
+                TV neighbor_vel_sum = TV::Zero();
                 int neighbor_cnt = 0;
-                for(int j=0;j<n;j++)
+                if(approx) wideSums(pos, vel, i, neighbor_pos_sum, neighbor_vel_sum, neighbor_cnt);
+                else forEachNeighbor(pos, vel, i, [&](int, const TV& q, const TV&)
                 {
-                    if(j == i) continue;
-                    if((pos.col(i)-pos.col(j)).norm()<=cohesion_radius) 
+                    const TV pj = box.image(pos.col(i), q);
+                    if((pos.col(i)-pj).norm()<=cohesion_radius) 
                     {
-                        neighbor_pos_sum += pos.col(j);
+                        neighbor_pos_sum += pj;
                         neighbor_cnt ++;
                     }
-                }
+                });
                 if(neighbor_cnt != 0)
                 {
                     neighbor_pos_sum /= neighbor_cnt;
-                    acc.col(i) = ck * (neighbor_pos_sum - pos.col(i));
+                    acc.col(i) = params.ck * (neighbor_pos_sum - pos.col(i));
                 }
             }
             return acc;
         }
         else if (type == ALIGNMENT)
         {
-            TVStack vel = TVStack::Zero(dim,n);
-            vel = getVelocities();
-
+            if(!slow) return acc;
+            const bool approx = prepareWideSums(pos, vel);
+            if(!approx) prepareNeighbors(pos, vel, params.cohesion_radius);
             for(int i=0;i<n;i++)
             {
+                if(skip_sleeping && !awake[i]) continue;
                 TV neighbor_pos_sum = TV::Zero();
                 TV neighbor_vel_sum = TV::Zero();
                 int neighbor_cnt = 0;
-                for(int j=0;j<n;j++)
+                if(approx) wideSums(pos, vel, i, neighbor_pos_sum, neighbor_vel_sum, neighbor_cnt);
+                else forEachNeighbor(pos, vel, i, [&](int, const TV& q, const TV& v)
                 {
-                    if(j == i) continue;
-                    if((pos.col(i)-pos.col(j)).norm()<=cohesion_radius) 
+                    const TV pj = box.image(pos.col(i), q);
+                    if((pos.col(i)-pj).norm()<=cohesion_radius) 
                     {
-                        neighbor_pos_sum += pos.col(j);
-                        neighbor_vel_sum += vel.col(j);
+                        neighbor_pos_sum += pj;
+                        neighbor_vel_sum += v;
                         neighbor_cnt ++;
                     }
-                }
+                });
                 if(neighbor_cnt != 0)
                 {
                     neighbor_pos_sum /= neighbor_cnt;
                     neighbor_vel_sum /= neighbor_cnt;
-                    acc.col(i) = ck * (neighbor_pos_sum - pos.col(i)) + ak * (neighbor_vel_sum - vel.col(i));
+                    acc.col(i) = params.ck * (neighbor_pos_sum - pos.col(i)) + params.ak * (neighbor_vel_sum - vel.col(i));
                 }
             }
             return acc;
         }
-        else if (type == SEPARATION)
+        else if (type == LEADER && !group_start.empty())
         {
-            TVStack vel = TVStack::Zero(dim,n);
-            vel = getVelocities();
-
-            for(int i=0;i<n;i++)
-            {
-                TV neighbor_pos_sum = TV::Zero();
-                TV neighbor_vel_sum = TV::Zero();
-                TV neighbor_repel_sum = TV::Zero();
-
-                int neighbor_cnt = 0;
-                for(int j=0;j<n;j++)
-                {
-                    if(j == i) continue;
-                    if((pos.col(i)-pos.col(j)).norm()<=cohesion_radius) 
-                    {
-                        neighbor_pos_sum += pos.col(j);
-                        neighbor_vel_sum += vel.col(j);
-                        neighbor_cnt ++;
-                    }
-                    if((pos.col(i)-pos.col(j)).norm()<=repel_radius) 
-                    {
-                        neighbor_repel_sum += rk*(pos.col(i)-pos.col(j));
-                    }
-                }
-                if(neighbor_cnt != 0)
-                {
-                    neighbor_pos_sum /= neighbor_cnt;
-                    neighbor_vel_sum /= neighbor_cnt;
-                    acc.col(i) = ck * (neighbor_pos_sum - pos.col(i)) + ak * (neighbor_vel_sum - vel.col(i)) + neighbor_repel_sum;
-                }
-            }
-            return acc;
+            return groupAcc(pos, vel, slow, repel, external, skip_sleeping, box);
         }
-        else if (type == COLLISION_AVOID)
+        else if (type == SEPARATION || type == COLLISION_AVOID || type == LEADER)
         {
-            TVStack vel = TVStack::Zero(dim,n);
-            vel = getVelocities();
-
-            for(int i=0;i<n;i++)
+            // the leader (boid 0) only follows the mouse
+            const int first = type == LEADER ? 1 : 0;
+            const T align_gain = type == LEADER ? 0.06*params.ak : params.ak;
+            const T repel_gain = type == LEADER ? 0.5 : 1;
+            const bool approx = slow && prepareWideSums(pos, vel);
+            const bool exact = slow && !approx; // cohesion/alignment summed in the pair loop
+            prepareNeighbors(pos, vel, exact ? std::max(params.cohesion_radius, params.repel_radius) : params.repel_radius);
+            if(type == COLLISION_AVOID && external)
             {
+                prepareObstacles();
+                prepareFlow();
+            }
+            for(int i=first;i<n;i++)
+            {
+                if(skip_sleeping && !awake[i]) continue;
                 TV neighbor_pos_sum = TV::Zero();
                 TV neighbor_vel_sum = TV::Zero();
                 TV neighbor_repel_sum = TV::Zero();
 
                 int neighbor_cnt = 0;
-                for(int j=0;j<n;j++)
+                if(approx) wideSums(pos, vel, i, neighbor_pos_sum, neighbor_vel_sum, neighbor_cnt);
+                forEachNeighbor(pos, vel, i, [&](int, const TV& q, const TV& v)
                 {
-                    if(j == i) continue;
-                    if((pos.col(i)-pos.col(j)).norm()<=cohesion_radius) 
+                    const TV pj = box.image(pos.col(i), q);
+                    T dist = (pos.col(i)-pj).norm();
+                    if(exact && dist<=cohesion_radius) 
                     {
-                        neighbor_pos_sum += pos.col(j);
-                        neighbor_vel_sum += vel.col(j);
+                        neighbor_pos_sum += pj;
+                        neighbor_vel_sum += v;
                         neighbor_cnt ++;
                     }
-                    if((pos.col(i)-pos.col(j)).norm()<=repel_radius) 
+                    if(repel && dist<=repel_radius) 
                     {
-                        neighbor_repel_sum += rk*(pos.col(i)-pos.col(j));
+                        neighbor_repel_sum += rk*(pos.col(i)-pj);
                     }
-                }
+                });
                 if(neighbor_cnt != 0)
                 {
                     neighbor_pos_sum /= neighbor_cnt;
                     neighbor_vel_sum /= neighbor_cnt;
-                    acc.col(i) = ck * (neighbor_pos_sum - pos.col(i)) + ak * (neighbor_vel_sum - vel.col(i)) + neighbor_repel_sum;
+                    acc.col(i) = params.ck * (neighbor_pos_sum - pos.col(i)) + align_gain * (neighbor_vel_sum - vel.col(i));
                 }
-                if((pos.col(i)-obs_pos).norm() <= obs_radius + eyesight_range)
-                {
-                    float N = (pos.col(i)-obs_pos).norm();
-                    float x = N -obs_radius;
-                    if(x<obs_effect_band) acc.col(i) += ok*pow(x,-obs_repel_power)*(pos.col(i)-obs_pos).normalized();
-                    acc.col(i) += ok*pow(obs_effect_band,-obs_repel_power)*(pos.col(i)-obs_pos)/N;
-                }
-                float drag = gpk*(fixed_goal_pos-pos.col(i)).norm();
-                acc.col(i) += (drag > max_drag ? max_drag : drag)*(fixed_goal_pos-pos.col(i)).normalized();
-                acc.col(i) += gdk*(-vel.col(i));
-            }
-            return acc;
-        }
-        else if (type == LEADER)
-        {
-            TVStack vel = TVStack::Zero(dim,n);
-            vel = getVelocities();
-            
-            for(int i=1;i<n;i++)
-            {
-                TV neighbor_pos_sum = TV::Zero();
-                TV neighbor_vel_sum = TV::Zero();
-                TV neighbor_repel_sum = TV::Zero();
-
-                int neighbor_cnt = 0;
-                for(int j=0;j<n;j++)
+                acc.col(i) += repel_gain*neighbor_repel_sum;
+                if(!external) continue;
+                if(type == COLLISION_AVOID)
                 {
-                    if(j == i) continue;
-                    if((pos.col(i)-pos.col(j)).norm()<=cohesion_radius) 
-                    {
-                        neighbor_pos_sum += pos.col(j);
-                        neighbor_vel_sum += vel.col(j);
-                        neighbor_cnt ++;
-                    }
-                    if((pos.col(i)-pos.col(j)).norm()<=repel_radius) 
+                    if(!params.obstacles.empty()) acc.col(i) += fieldRepulsion(pos.col(i));
+                    else if((pos.col(i)-params.obs_pos).norm() <= params.obs_radius + params.eyesight_range)
                     {
-                        neighbor_repel_sum += rk*(pos.col(i)-pos.col(j));
+                        T N = (pos.col(i)-params.obs_pos).norm();
+                        T x = N -params.obs_radius;
+                        if(x<params.obs_effect_band) acc.col(i) += params.ok*pow(x,-params.obs_repel_power)*(pos.col(i)-params.obs_pos).normalized();
+                        acc.col(i) += params.ok*pow(params.obs_effect_band,-params.obs_repel_power)*(pos.col(i)-params.obs_pos)/N;
                     }
+                    T drag = params.gpk*(params.fixed_goal_pos-pos.col(i)).norm();
+                    if(params.flow_field) acc.col(i) += (drag > params.max_drag ? params.max_drag : drag)*goalDirection(pos.col(i));
+                    else acc.col(i) += (drag > params.max_drag ? params.max_drag : drag)*(params.fixed_goal_pos-pos.col(i)).normalized();
+                    acc.col(i) += params.gdk*(-vel.col(i));
                 }
-                if(neighbor_cnt != 0)
+                else if(type == LEADER)
                 {
-                    neighbor_pos_sum /= neighbor_cnt;
-                    neighbor_vel_sum /= neighbor_cnt;
-                    acc.col(i) = ck * (neighbor_pos_sum - pos.col(i)) + 0.06*ak * (neighbor_vel_sum - vel.col(i)) + 0.5*neighbor_repel_sum;
+                    const TV leader = box.image(pos.col(i), pos.col(0));
+                    T drag = params.gpk*(leader-pos.col(i)).norm();
+                    acc.col(i) += (drag > params.max_drag ? params.max_drag : drag)*(leader-pos.col(i)).normalized();
+                    acc.col(i) += 0.3*params.gdk*(vel.col(0)-vel.col(i));
                 }
-                float drag = gpk*(pos.col(0)-pos.col(i)).norm();
-                acc.col(i) += (drag > max_drag ? max_drag : drag)*(pos.col(0)-pos.col(i)).normalized();
-                acc.col(i) += 0.3*gdk*(vel.col(0)-vel.col(i));
             }
-            float target_drag = gpk*(mouse_pos-pos.col(0)).norm();
-            acc.col(0) += (target_drag > max_drag ? max_drag : target_drag)*(mouse_pos-pos.col(0)).normalized();
-            acc.col(0) += 0.5*gdk*(-vel.col(0));
+            if(type == LEADER && external)
+            {
+                T target_drag = params.gpk*(mouse_pos-pos.col(0)).norm();
+                acc.col(0) += (target_drag > params.max_drag ? params.max_drag : target_drag)*(mouse_pos-pos.col(0)).normalized();
+                acc.col(0) += 0.5*params.gdk*(-vel.col(0));
+            }
             return acc;
         }
+        return acc;
     }
 //---------------------------------------------------------------------------------------------------
-    void breed(TVStack &pos, TVStack &vel)
+// every pair closer than breed_range gets a child at its midpoint, appended in the order of the pairs (i, j), i < j.
+// Chunks of boids find their pairs in a grid on the pool, a prefix sum over the chunks places their
+// children, so the result is the same for any number of threads.
+// With slots only the live boids breed and the children take the lowest free slots, in the same
+// order, until the slot pool is full.
+    void breed(TVStack &pos, TVStack &vel, SlotPool* slots = nullptr)
     {
+        PROFILE_SCOPE("breed");
         int n = pos.cols(); // n should be fixed
-        for(int i=0;i<n-1;i++)
+        if(n < 2) return;
+        breed_grid.build(pos, params.breed_range, params.periodic ? T(params.period) : T(0));
+        const int chunks = (n + breed_chunk - 1)/breed_chunk;
+        breed_pairs.resize(chunks);
+        auto findPairs = [&](int c, int) {
+            std::vector<std::pair<int, int>>& pairs = breed_pairs[c];
+            pairs.clear();
+            for(int i=c*breed_chunk;i<std::min(n, (c+1)*breed_chunk);i++)
+            {
+                if(slots && !slots->alive(i)) continue;
+                const size_t first = pairs.size();
+                breed_grid.forEachNear(pos.col(i), params.breed_range, [&](int j) {
+                    if(j > i && (!slots || slots->alive(j)) && (pos.col(i)-image(pos.col(i), pos.col(j))).norm()<params.breed_range)
+                        pairs.emplace_back(i, j);
+                });
+                std::sort(pairs.begin()+first, pairs.end()); // the grid returns them cell by cell
+            }
+        };
+        if(pool) pool->parallelFor(0, chunks, findPairs);
+        else for(int c=0;c<chunks;c++) findPairs(c, 0);
+
+        if(slots)
         {
-            for(int j=i+1;j<n;j++)
+            // a child's slot was free, so it is no parent of a later pair
+            for(int c=0;c<chunks;c++)
             {
-                if((pos.col(i)-pos.col(j)).norm()<breed_range)
+                for(const std::pair<int, int>& pair : breed_pairs[c])
                 {
-                    TV child_pos = (pos.col(i) + pos.col(j))/2;
-                    TV child_vel = (vel.col(i) + vel.col(j))/2;
-                    pos.conservativeResize(pos.rows(), pos.cols()+1);
-                    pos.col(pos.cols()-1) = child_pos;
-                    vel.conservativeResize(vel.rows(), vel.cols()+1);
-                    vel.col(vel.cols()-1) = child_vel;
+                    const int k = slots->take();
+                    if(k < 0) return;
+                    pos.col(k) = (pos.col(pair.first) + image(pos.col(pair.first), pos.col(pair.second)))/2;
+                    vel.col(k) = (vel.col(pair.first) + vel.col(pair.second))/2;
                 }
             }
+            return;
         }
+        std::vector<int> start(chunks + 1, n); // first column of the children of every chunk
+        for(int c=0;c<chunks;c++) start[c+1] = start[c] + int(breed_pairs[c].size());
+        if(start[chunks] == n) return;
+        pos.conservativeResize(pos.rows(), start[chunks]);
+        vel.conservativeResize(vel.rows(), start[chunks]);
+        auto placeChildren = [&](int c, int) {
+            int k = start[c];
+            for(const std::pair<int, int>& pair : breed_pairs[c])
+            {
+                const int i = pair.first, j = pair.second;
+                pos.col(k) = (pos.col(i) + image(pos.col(i), pos.col(j)))/2;
+                vel.col(k) = (vel.col(i) + vel.col(j))/2;
+                k++;
+            }
+        };
+        if(pool) pool->parallelFor(0, chunks, placeChildren);
+        else for(int c=0;c<chunks;c++) placeChildren(c, 0);
     }
     void removeCol(TVStack &Matrix, int i)
     {
@@ -334,12 +509,76 @@ public:
         int cols = Matrix.cols();
         if(i>=0 && i<cols)
         {
-            Matrix.block(0,i,rows,cols-i) = Matrix.rightCols(cols-i-1);
+            Matrix.block(0,i,rows,cols-i-1) = Matrix.rightCols(cols-i-1);
             Matrix.conservativeResize(rows,cols-1);
         }
     }
+    // the spawned team fills the first slots of a pool of population_cap slots, boids past the cap are dropped
+    void allocatePool(TVStack& pos, TVStack& vel, SlotPool& slots)
+    {
+        const int cap = params.population_cap;
+        const int used = std::min(int(pos.cols()), cap);
+        TVStack spawned_pos = pos.leftCols(used), spawned_vel = vel.leftCols(used);
+        pos = vel = TVStack::Zero(dim, cap);
+        pos.leftCols(used) = spawned_pos;
+        vel.leftCols(used) = spawned_vel;
+        slots.reset(cap, used);
+    }
+    TVStack liveColumns(const TVStack& m, const SlotPool& slots) const
+    {
+        TVStack live(dim, slots.size());
+        for(int slot=0, k=0;slot<m.cols();slot++)
+            if(slots.alive(slot)) live.col(k++) = m.col(slot);
+        return live;
+    }
+    TV liveMean(const TVStack& m, const SlotPool& slots) const
+    {
+        TV sum = TV::Zero();
+        for(int slot=0;slot<m.cols();slot++)
+            if(slots.alive(slot)) sum += m.col(slot);
+        return sum/T(slots.size());
+    }
+    // attack on the slot pools: both teams count their enemies and crowding on the same positions,
+    // then the slots of the dead are freed, their boids stop where they are
+    void attackSlots()
+    {
+        PROFILE_SCOPE("attack");
+        auto findDead = [&](const TVStack& own, const SlotPool& own_slots, const TVStack& enemy, const SlotPool& enemy_slots,
+                            std::vector<int>& dead) {
+            dead.clear();
+            for(int i=0;i<own.cols();i++)
+            {
+                if(!own_slots.alive(i)) continue;
+                int enemy_cnt = 0;
+                int repel_cnt = 0;
+                for(int j=0;j<enemy.cols();j++)
+                    if(enemy_slots.alive(j) && (image(own.col(i), enemy.col(j))-own.col(i)).norm()<params.death_range) enemy_cnt++;
+                for(int j=0;j<own.cols();j++)
+                    if(own_slots.alive(j) && (image(own.col(i), own.col(j))-own.col(i)).norm()<params.repel_death_ratio*params.repel_radius) repel_cnt++;
+                if(enemy_cnt>=params.enemy_kill||repel_cnt>=params.repel_num) dead.push_back(i);
+            }
+        };
+        findDead(A_pos, A_slots, B_pos, B_slots, dead_A);
+        findDead(B_pos, B_slots, A_pos, A_slots, dead_B);
+        for(int i : dead_A)
+        {
+            A_slots.release(i);
+            A_vel.col(i).setZero();
+        }
+        for(int i : dead_B)
+        {
+            B_slots.release(i);
+            B_vel.col(i).setZero();
+        }
+    }
     void attack(TVStack &posA, TVStack &posB, TVStack &velA, TVStack &velB)
     {
+        if(pooled)
+        {
+            attackSlots();
+            return;
+        }
+        PROFILE_SCOPE("attack");
         TVStack old_posA = posA;
         TVStack old_posB = posB;
         for(int i=0;i < old_posA.cols();i++)
@@ -348,13 +587,13 @@ public:
             int repel_cnt = 0;
             for(int j=0;j < old_posB.cols();j++)
             {
-                if((old_posB.col(j)-old_posA.col(i)).norm()<death_range) enemy_cnt++;
+                if((image(old_posA.col(i), old_posB.col(j))-old_posA.col(i)).norm()<params.death_range) enemy_cnt++;
             }
             for(int j=0;j < old_posA.cols();j++)
             {
-                if((old_posA.col(j)-old_posA.col(i)).norm()<repel_death_ratio*repel_radius) repel_cnt++;
+                if((image(old_posA.col(i), old_posA.col(j))-old_posA.col(i)).norm()<params.repel_death_ratio*params.repel_radius) repel_cnt++;
             }
-            if(enemy_cnt>=enemy_kill||repel_cnt>=repel_num)
+            if(enemy_cnt>=params.enemy_kill||repel_cnt>=params.repel_num)
             {
                 removeCol(posA,i);
                 removeCol(velA,i);
@@ -367,92 +606,115 @@ public:
             int repel_cnt = 0;
             for(int j=0;j < old_posA.cols();j++)
             {
-                if((old_posA.col(j)-old_posB.col(i)).norm()<death_range) enemy_cnt++;
+                if((image(old_posB.col(i), old_posA.col(j))-old_posB.col(i)).norm()<params.death_range) enemy_cnt++;
             }
             for(int j=0;j < old_posB.cols();j++)
             {
-                if((old_posB.col(j)-old_posB.col(i)).norm()<repel_death_ratio*repel_radius) repel_cnt++;
+                if((image(old_posB.col(i), old_posB.col(j))-old_posB.col(i)).norm()<params.repel_death_ratio*params.repel_radius) repel_cnt++;
             }
-            if(enemy_cnt>=enemy_kill||repel_cnt>=repel_num)
+            if(enemy_cnt>=params.enemy_kill||repel_cnt>=params.repel_num)
             {
                 removeCol(posB,i);
                 removeCol(velB,i);
             }
         }
     }
-    TVStack CA_acc(TVStack pos, TVStack vel, bool isControlled = false)
+// slots: the live columns of a team in a slot pool, the others neither feel nor exert forces
+    TVStack CA_acc(const TVStack& pos, const TVStack& vel, bool isControlled = false, ForceParts parts = ALL_FORCES,
+                   const SlotPool* slots = nullptr)
+    {
+        if(params.periodic) return CA_acc(pos, vel, isControlled, parts, slots, periodicBox());
+        return CA_acc(pos, vel, isControlled, parts, slots, OpenBox<T, dim>());
+    }
+    template <class Box>
+    TVStack CA_acc(const TVStack& pos, const TVStack& vel, bool isControlled, ForceParts parts, const SlotPool* slots, const Box& box)
     {
+        PROFILE_SCOPE("forces");
         TVStack acc = TVStack::Zero(dim,pos.cols());
+        const T cohesion_radius = params.cohesion_radius, repel_radius = params.repel_radius, rk = params.rk;
+        const bool slow = parts & SLOW_FORCES;
+        const bool repel = parts & REPULSION;
+        const bool external = parts & EXTERNAL_FORCES;
+        const bool approx = slow && prepareWideSums(pos, vel, slots);
+        const bool exact = slow && !approx; // cohesion/alignment summed in the pair loop
+        prepareNeighbors(pos, vel, exact ? std::max(params.cohesion_radius, params.repel_radius) : params.repel_radius);
+        const int own_count = slots ? slots->size() : int(pos.cols());
+        const int enemy_count = pooled ? B_slots.size() : int(B_pos.cols());
         for(int i=0;i<pos.cols();i++)
         {
+            if(slots && !slots->alive(i)) continue;
             TV neighbor_pos_sum = TV::Zero();
             TV neighbor_vel_sum = TV::Zero();
             TV neighbor_repel_sum = TV::Zero();
 
             int neighbor_cnt = 0;
-            for(int j=0;j<pos.cols();j++)
+            if(approx) wideSums(pos, vel, i, neighbor_pos_sum, neighbor_vel_sum, neighbor_cnt);
+            forEachNeighbor(pos, vel, i, [&](int j, const TV& q, const TV& v)
             {
-                if(j == i) continue;
-                if((pos.col(i)-pos.col(j)).norm()<=cohesion_radius) 
+                if(slots && !slots->alive(j)) return;
+                const TV pj = box.image(pos.col(i), q);
+                T dist = (pos.col(i)-pj).norm();
+                if(exact && dist<=cohesion_radius) 
                 {
-                    neighbor_pos_sum += pos.col(j);
-                    neighbor_vel_sum += vel.col(j);
+                    neighbor_pos_sum += pj;
+                    neighbor_vel_sum += v;
                     neighbor_cnt ++;
                 }
-                if((pos.col(i)-pos.col(j)).norm()<=repel_radius) 
+                if(repel && dist<=repel_radius) 
                 {
-                    neighbor_repel_sum += rk*(pos.col(i)-pos.col(j));
+                    neighbor_repel_sum += rk*(pos.col(i)-pj);
                 }
-            }
+            });
             if(neighbor_cnt != 0)
             {
                 neighbor_pos_sum /= neighbor_cnt;
                 neighbor_vel_sum /= neighbor_cnt;
-                acc.col(i) = ck * (neighbor_pos_sum - pos.col(i)) + ak * (neighbor_vel_sum - vel.col(i)) + neighbor_repel_sum;
+                acc.col(i) = params.ck * (neighbor_pos_sum - pos.col(i)) + params.ak * (neighbor_vel_sum - vel.col(i));
+            }
+            acc.col(i) += neighbor_repel_sum;
+            if(!external) continue;
+            for(int d=0;d<dim && !params.periodic;d++) // a periodic box has no walls
+            {
+                if(pos.col(i)[d] > +params.safe_edge-params.bound_edge)  acc.col(i)[d]+= -params.bound_repel_acc;
+                if(pos.col(i)[d] < -params.safe_edge+params.bound_edge)  acc.col(i)[d]+= +params.bound_repel_acc;
             }
-            if(pos.col(i)[0] > +safe_edge-bound_edge)  acc.col(i)[0]+= -bound_repel_acc;
-            if(pos.col(i)[0] < -safe_edge+bound_edge)  acc.col(i)[0]+= +bound_repel_acc;
-            if(pos.col(i)[1] > +safe_edge-bound_edge)  acc.col(i)[1]+= -bound_repel_acc;
-            if(pos.col(i)[1] < -safe_edge+bound_edge)  acc.col(i)[1]+= +bound_repel_acc;
 
-            if(isControlled)
-            {
-                // strategy 1
-                //acc.col(i) += -pos.col(i);// quick attack, quick retreat
-                // strategy 2
-                /*
-                TV my_pos_avg = pos.colwise().mean();
-                TVStack Bpos = get_B_pos();
-                TV nearest_enemy = TV(0,0);
-                if(Bpos.cols()>0)
+            if(isControlled && enemy_count>0)
+            {
+                if(params.strategy == 1)
+                {
+                    // strategy 1: seize the origin, quick attack and quick retreat
+                    acc.col(i) += -pos.col(i);
+                }
+                else if(params.strategy == 2)
                 {
-                    nearest_enemy = Bpos.col(0);
-                    for(int i=0;i<Bpos.cols();i++)
+                    // strategy 2: take advantage of local majority, chase the rightest enemy
+                    int first = 0;
+                    while(pooled && !B_slots.alive(first)) first++;
+                    TV nearest_enemy = B_pos.col(first);
+                    for(int j=first;j<B_pos.cols();j++)
                     {
-                        if(Bpos.col(i)[0]>nearest_enemy[0])
+                        if(pooled && !B_slots.alive(j)) continue;
+                        if(B_pos.col(j)[0]>nearest_enemy[0])
                         {
-                            nearest_enemy = Bpos.col(i);
+                            nearest_enemy = B_pos.col(j);
                         }
                     }
                     acc.col(i) += (nearest_enemy - pos.col(i));
                 }
-                */
-                // strategy 3
-                TVStack Bpos = get_B_pos();
-                if(Bpos.cols()>0 && pos.cols()<180)
+                else if(params.strategy == 3 && own_count<180)
                 {
-                    TV nearest_enemy = TV(0,0);
-                    TV avg = get_B_pos().colwise().mean();
-                    TV my_pos_avg = pos.colwise().mean();
+                    // strategy 3: warriors (even index) and breeders (odd index)
+                    TV avg = pooled ? liveMean(B_pos, B_slots) : TV(B_pos.rowwise().mean());
                     if(i%2 == 0)
                     {
-                        float N = (pos.col(i)-avg).norm();
-                        float x = N-0.1;
-                        if(x<0.1) acc.col(i) += ok*pow(x,-obs_repel_power)*(pos.col(i)-avg).normalized();
-                        //acc.col(i) += ok*pow(0.1,-obs_repel_power)*(pos.col(i)-avg)/N;
-                        float drag = gpk*(avg-pos.col(i)).norm();
+                        T N = (pos.col(i)-avg).norm();
+                        T x = N-0.1;
+                        if(x<0.1) acc.col(i) += params.ok*pow(x,-params.obs_repel_power)*(pos.col(i)-avg).normalized();
+                        //acc.col(i) += params.ok*pow(0.1,-params.obs_repel_power)*(pos.col(i)-avg)/N;
+                        T drag = params.gpk*(avg-pos.col(i)).norm();
                         acc.col(i) += 0.5*drag*(avg-pos.col(i)).normalized();
-                        acc.col(i) += gdk*(-vel.col(i));
+                        acc.col(i) += params.gdk*(-vel.col(i));
                     }
                 }
             }
@@ -460,58 +722,480 @@ public:
         return acc;
 
     }
+// symplectic euler step of pos and vel, the separation springs are solved
+// semi-implicitly, every other force comes explicitly from other_acc
+    void semiImplicitUpdate(TVStack& pos, TVStack& vel, const std::function<TVStack(const TVStack&, const TVStack&)>& other_acc,
+                            const SlotPool* slots = nullptr)
+    {
+        pos = Xupdate(pos, vel);
+        TVStack acc = other_acc(pos, vel);
+        TVStack repel_dv;
+        {
+            PROFILE_SCOPE("implicit repulsion");
+            repel_dv = repulsion_solver.solve(pos, params.repel_radius, params.rk, params.h, params.cg_iterations, params.cg_tolerance,
+                                              params.periodic ? T(params.period) : T(0), slots ? &slots->mask() : nullptr);
+        }
+        PROFILE_SCOPE("integrate");
+        vel += params.h*acc + repel_dv;
+    }
+
 // updateBehavior: choose update rule by updateMode
     void updateBehavior(MethodTypes type)
     {
+        PROFILE_SCOPE("update");
         if(!update)  return; // if !update == True, simulation do not update i.e. pause
         if(type == CA_BEHAVE)
         {
             cnt++;
-            if(cnt % breed_gap ==0)
+            if(cnt % params.breed_gap ==0)
             {
-                breed(A_pos,A_vel);
-                breed(B_pos,B_vel);
-                std::cout<<cnt<<'\n';
+                breed(A_pos,A_vel,pooled ? &A_slots : nullptr);
+                breed(B_pos,B_vel,pooled ? &B_slots : nullptr);
+                if(params.verbose) std::cout<<cnt<<'\n';
             }
             attack(A_pos,B_pos,A_vel,B_vel);
-            A_pos = Xupdate(A_pos,A_vel);
-            A_vel = Vupdate(A_vel,CA_acc(A_pos,A_vel,true));
-            B_pos = Xupdate(B_pos,B_vel);
-            B_vel = Vupdate(B_vel,CA_acc(B_pos,B_vel));
-            std::cout<<"Boids A vs Boid Bs"<<get_A_pos().cols()<<":"<<get_B_pos().cols()<<'\n';
+            if(params.implicit_repulsion)
+            {
+                const SlotPool* a = pooled ? &A_slots : nullptr;
+                const SlotPool* b = pooled ? &B_slots : nullptr;
+                semiImplicitUpdate(A_pos, A_vel, [&](const TVStack& pos, const TVStack& vel) {return CA_acc(pos, vel, true, ForceParts(SLOW_FORCES|EXTERNAL_FORCES), a);}, a);
+                semiImplicitUpdate(B_pos, B_vel, [&](const TVStack& pos, const TVStack& vel) {return CA_acc(pos, vel, false, ForceParts(SLOW_FORCES|EXTERNAL_FORCES), b);}, b);
+            }
+            else
+            {
+                A_pos = Xupdate(A_pos,A_vel);
+                A_vel = Vupdate(A_vel,CA_acc(A_pos,A_vel,true,ALL_FORCES,pooled ? &A_slots : nullptr));
+                B_pos = Xupdate(B_pos,B_vel);
+                B_vel = Vupdate(B_vel,CA_acc(B_pos,B_vel,false,ALL_FORCES,pooled ? &B_slots : nullptr));
+            }
+            if(params.periodic)
+            {
+                wrapPositions(A_pos);
+                wrapPositions(B_pos);
+            }
+            integrator_state.time += params.h;
+            if(params.verbose) std::cout<<"Boids A vs Boid Bs"<<get_A_count()<<":"<<get_B_count()<<'\n';
         }
         else
         {
-            TVStack acc = TVStack::Zero(dim,n); // init acc
-            if(updateMode == 0) // Ex1: Basic Time Integration 25%
+            if(type != integrated_type)
+            {
+                integrator_state.invalidate();
+                wakeAll();
+            }
+            integrated_type = type;
+            if(params.sleeping && sleeping_count == n) integrator_state.time += params.h; // nothing moves, nothing to evaluate
+            else updateFlock(type);
+            if(params.periodic) wrapPositions(positions);
+            if(type == LEADER && !group_start.empty()) regroup();
+            if(params.sleeping) updateSleeping(type);
+        }
+    }
+// one step of the flocking methods
+    void updateFlock(MethodTypes type)
+    {
+        if(params.implicit_repulsion && params.updateMode == SYMPLECTIC_EULER && (type == SEPARATION || type == COLLISION_AVOID))
+        {
+            semiImplicitUpdate(positions, velocities, [&](const TVStack& pos, const TVStack& vel) {
+                wide_evals++;
+                return getAcc(type, pos, vel, ForceParts(SLOW_FORCES|EXTERNAL_FORCES));
+            });
+            force_evals++;
+            integrator_state.last_h = params.h;
+            integrator_state.time += params.h;
+        }
+        else
+        {
+            // the integrator is picked by updateMode, see integrators.h
+            const Integrator<T, dim>& integrator = getIntegrator<T, dim>(params.updateMode);
+            integrator_state.tolerance = params.tolerance;
+            integrator_state.h_min = params.h_min;
+            integrator_state.h_max = params.h_max;
+            integrator_state.h_floor = params.adaptive_floor ? params.h : T(0);
+            integrator_state.respa_steps = params.respa_steps;
+            integrator_state.last_h = params.h; // the adaptive integrator overwrites it
+            force_evals += integrator.step(positions, velocities, params.h,
+                [&](const TVStack& pos, const TVStack& vel, ForceParts parts) {
+                    if((parts & SLOW_FORCES) && type >= COHESION) wide_evals++;
+                    return getAcc(type, pos, vel, parts);
+                }, integrator_state);
+            integrator_state.time += integrator_state.last_h;
+        }
+    }
+// puts boids that stayed calm for sleep_steps to sleep and wakes sleepers near moving boids.
+// Settled boids keep jittering in the repulsion, so the step forces are large; what decides is
+// how far the boid got and how much its velocity changed over the calm steps.
+// Sleepers stay in the neighbor queries of the awake boids, which still bump into them.
+    void updateSleeping(MethodTypes type)
+    {
+        PROFILE_SCOPE("sleeping");
+        std::vector<int> movers; // awake boids fast enough to wake others
+        for(int i=0;i<n;i++)
+        {
+            if(!awake[i])
+            {
+                velocities.col(i).setZero(); // the implicit repulsion may have pushed it
+                continue;
+            }
+            T speed = velocities.col(i).norm();
+            if(speed > 2*params.sleep_velocity) movers.push_back(i);
+            if(speed >= params.sleep_velocity || (type == LEADER && i == 0)) // the leader follows the mouse
+            {
+                calm_steps[i] = 0;
+                continue;
+            }
+            if(calm_steps[i] == 0)
             {
-                TVStack old_pos = TVStack::Zero(dim,n);
-                TVStack old_vel = TVStack::Zero(dim,n);
-                old_pos = positions;
-                old_vel = velocities;
-                acc = getAcc(type,old_pos);
-                positions = Xupdate(old_pos,old_vel);
-                velocities = Vupdate(old_vel,acc);
+                calm_pos.col(i) = positions.col(i);
+                calm_vel.col(i) = velocities.col(i);
             }
-            else if(updateMode == 1) // EX2: Advanced Time Integration 25%, symplectic Euler
+            if(++calm_steps[i] < params.sleep_steps) continue;
+            T time = params.sleep_steps*integrator_state.last_h;
+            if((positions.col(i)-image(positions.col(i), calm_pos.col(i))).norm() < params.sleep_distance
+                && (velocities.col(i)-calm_vel.col(i)).norm() < params.sleep_acc*time)
             {
-                positions = Xupdate(positions,velocities);
-                acc = getAcc(type, positions); // <--- Updated positions here!
-                velocities = Vupdate(velocities,acc);
+                awake[i] = 0;
+                velocities.col(i).setZero();
+                // the cached forces would still move it in the next step (velocity verlet, r-RESPA)
+                if(integrator_state.acc.cols() == n) integrator_state.acc.col(i).setZero();
+                if(integrator_state.slow_acc.cols() == n) integrator_state.slow_acc.col(i).setZero();
+                sleeping_count++;
             }
-            else // EX2: Advanced Time Integration 25%, explicit midpoint
-            {
-                acc = getAcc(type, positions);
-                TVStack mid_pos = TVStack::Zero(dim,n);
-                TVStack mid_vel = TVStack::Zero(dim,n);
-                mid_pos = Xupdate(positions,velocities,true);
-                mid_vel = Vupdate(velocities,acc,true);
-                acc = getAcc(type,mid_pos);
-                positions = Xupdate(positions,mid_vel);
-                velocities = Vupdate(velocities,acc);
+            calm_steps[i] = 0;
+        }
+        if(sleeping_count == 0 || movers.empty()) return;
+        TVStack mover_pos(dim, movers.size());
+        for(size_t k=0;k<movers.size();k++) mover_pos.col(k) = positions.col(movers[k]);
+        wake_grid.build(mover_pos, params.wake_radius, params.periodic ? T(params.period) : T(0));
+        for(int i=0;i<n;i++)
+        {
+            if(awake[i]) continue;
+            wake_grid.forEachNear(positions.col(i), params.wake_radius, [&](int k)
+            {
+                if(awake[i] || (positions.col(i)-image(positions.col(i), mover_pos.col(k))).norm() > params.wake_radius) return;
+                awake[i] = 1;
+                sleeping_count--;
+            });
+        }
+    }
+    // wakes the sleepers within range of the box [lo, hi] of the plane
+    void wakeNear(const Vector<T, 2>& lo, const Vector<T, 2>& hi, T range)
+    {
+        if(int(awake.size()) != n) return;
+        for(int i=0;i<n && sleeping_count>0;i++)
+        {
+            if(awake[i]) continue;
+            const Vector<T, 2> p = positions.col(i).template head<2>();
+            if((p - p.cwiseMax(lo).cwiseMin(hi)).norm() > range) continue;
+            awake[i] = 1;
+            calm_steps[i] = 0;
+            sleeping_count--;
+        }
+    }
+    void wakeAll()
+    {
+        awake.assign(n, 1);
+        calm_steps.assign(n, 0);
+        calm_pos = calm_vel = TVStack::Zero(dim, n);
+        sleeping_count = 0;
+    }
+    PeriodicBox<T, dim> periodicBox() const
+    {
+        PeriodicBox<T, dim> box;
+        box.period = params.period;
+        return box;
+    }
+    // the periodic copy of q nearest to p, q itself unless params.periodic
+    TV image(const TV& p, const TV& q) const
+    {
+        return params.periodic ? periodicBox().image(p, q) : q;
+    }
+    void wrapPositions(TVStack& pos) const
+    {
+        pos = pos.unaryExpr([this](T x) { return wrapCoordinate(x, T(params.period)); });
+    }
+    // neighbor queries of the next force loop reach at most radius
+    void prepareNeighbors(const TVStack& pos, const TVStack& vel, T radius)
+    {
+        use_grid = params.neighbor_grid;
+        if(!use_grid) return;
+        PROFILE_SCOPE("grid");
+        grid.build(pos, radius, params.periodic ? T(params.period) : T(0));
+        if(params.compact_storage) grid.pack(vel);
+    }
+    // fn(j, q, v) for every boid j != i that may lie within the radius of prepareNeighbors, all of them without the grid;
+    // q and v are its position and velocity, from the 16-bit copy of the grid with params.compact_storage
+    template <class Fn>
+    void forEachNeighbor(const TVStack& pos, const TVStack& vel, int i, Fn&& fn) const
+    {
+        if(!use_grid)
+        {
+            for(int j=0;j<pos.cols();j++)
+                if(j != i) fn(j, pos.col(j), vel.col(j));
+            return;
+        }
+        if(params.compact_storage)
+        {
+            grid.forEachNearPacked(pos.col(i), grid.cellSize(), [&](int j, const TV& q, const TV& v)
+            {
+                if(j != i) fn(j, q, v);
+            });
+            return;
+        }
+        grid.forEachNear(pos.col(i), grid.cellSize(), [&](int j)
+        {
+            if(j != i) fn(j, pos.col(j), vel.col(j));
+        });
+    }
+    // builds the approximation of the cohesion/alignment sums, false when they are summed exactly
+    // (also in a periodic box, the tree and the cell sums do not wrap); slots: only its live boids count
+    bool prepareWideSums(const TVStack& pos, const TVStack& vel, const SlotPool* slots = nullptr)
+    {
+        if(params.periodic) return false;
+        const std::vector<char>* live = slots ? &slots->mask() : nullptr;
+        if(params.wide_sums == TREE_SUMS)
+        {
+            PROFILE_SCOPE("tree");
+            tree.build(pos, vel, live);
+            return true;
+        }
+        if(params.wide_sums == CELL_SUMS)
+        {
+            PROFILE_SCOPE("cell sums");
+            sum_grid.build(pos, params.cohesion_radius/std::max(params.sum_cells, 1), 0, live);
+            sum_grid.accumulate(pos, vel);
+            return true;
+        }
+        return false;
+    }
+    // sums of the positions, velocities and count of the boids within cohesion_radius of boid i
+    void wideSums(const TVStack& pos, const TVStack& vel, int i, TV& pos_sum, TV& vel_sum, int& count) const
+    {
+        if(params.wide_sums == TREE_SUMS) tree.sums(pos, vel, i, params.cohesion_radius, params.theta, pos_sum, vel_sum, count);
+        else sum_grid.cellSums(pos, vel, i, params.cohesion_radius, params.exact_boundary, pos_sum, vel_sum, count);
+    }
+    void prepareObstacles()
+    {
+        if(field_valid || params.obstacles.empty()) return;
+        PROFILE_SCOPE("obstacle field");
+        // the band reaches two cells past eyesight_range, so the gradient there is not cut by the clamping
+        obstacle_field.build(params.obstacles, params.field_cell, params.eyesight_range + 2*params.field_cell);
+        field_valid = true;
+    }
+    // LEADER groups: the first K columns become the leaders, every follower joins the group of its nearest leader
+    void formGroups()
+    {
+        const int leaders = std::min(params.leaders, n);
+        std::vector<int> group(n, 0), count(leaders + 1, 0);
+        for(int i=leaders;i<n;i++)
+        {
+            group[i] = nearestLeader(positions.col(i), leaders);
+            count[group[i] + 1]++;
+        }
+        group_start.assign(leaders + 1, leaders);
+        for(int g=0;g<leaders;g++) group_start[g+1] = group_start[g] + count[g+1];
+        // stable counting sort of the followers by group
+        std::vector<int> fill(group_start.begin(), group_start.end()-1);
+        TVStack pos = positions, vel = velocities;
+        for(int i=leaders;i<n;i++)
+        {
+            int slot = fill[group[i]]++;
+            positions.col(slot) = pos.col(i);
+            velocities.col(slot) = vel.col(i);
+        }
+    }
+    int nearestLeader(const TV& p, int leaders) const
+    {
+        int nearest = 0;
+        T best = (image(p, positions.col(0))-p).squaredNorm();
+        for(int g=1;g<leaders;g++)
+        {
+            T d = (image(p, positions.col(g))-p).squaredNorm();
+            if(d < best)
+            {
+                best = d;
+                nearest = g;
+            }
+        }
+        return nearest;
+    }
+    // LEADER forces group by group: followers flock only with their own group and its leader,
+    // every group is one contiguous batch of columns, the batches run in parallel on the pool
+    template <class Box>
+    TVStack groupAcc(const TVStack& pos, const TVStack& vel, bool slow, bool repel, bool external, bool skip_sleeping, const Box& box)
+    {
+        const int leaders = int(group_start.size()) - 1;
+        TVStack acc = TVStack::Zero(dim, n);
+        const T align_gain = 0.06*params.ak;
+        const T cohesion_radius = params.cohesion_radius, repel_radius = params.repel_radius, rk = params.rk;
+        auto group = [&](int g, int) {
+            PROFILE_SCOPE("group");
+            const int begin = group_start[g], end = group_start[g+1];
+            for(int i=begin;i<end;i++)
+            {
+                if(skip_sleeping && !awake[i]) continue;
+                TV neighbor_pos_sum = TV::Zero();
+                TV neighbor_vel_sum = TV::Zero();
+                TV neighbor_repel_sum = TV::Zero();
+                int neighbor_cnt = 0;
+                auto visit = [&](int j) {
+                    const TV pj = box.image(pos.col(i), pos.col(j));
+                    T dist = (pos.col(i)-pj).norm();
+                    if(slow && dist<=cohesion_radius)
+                    {
+                        neighbor_pos_sum += pj;
+                        neighbor_vel_sum += vel.col(j);
+                        neighbor_cnt ++;
+                    }
+                    if(repel && dist<=repel_radius)
+                    {
+                        neighbor_repel_sum += rk*(pos.col(i)-pj);
+                    }
+                };
+                visit(g);
+                for(int j=begin;j<end;j++)
+                    if(j != i) visit(j);
+                if(neighbor_cnt != 0)
+                {
+                    neighbor_pos_sum /= neighbor_cnt;
+                    neighbor_vel_sum /= neighbor_cnt;
+                    acc.col(i) = params.ck * (neighbor_pos_sum - pos.col(i)) + align_gain * (neighbor_vel_sum - vel.col(i));
+                }
+                acc.col(i) += 0.5*neighbor_repel_sum;
+                if(!external) continue;
+                const TV leader = box.image(pos.col(i), pos.col(g));
+                T drag = params.gpk*(leader-pos.col(i)).norm();
+                acc.col(i) += (drag > params.max_drag ? params.max_drag : drag)*(leader-pos.col(i)).normalized();
+                acc.col(i) += 0.3*params.gdk*(vel.col(g)-vel.col(i));
             }
+        };
+        if(pool) pool->parallelFor(0, leaders, group);
+        else for(int g=0;g<leaders;g++) group(g, 0);
+        if(!external) return acc;
+
+        // leader 0 follows the mouse, leader g > 0 keeps leader_spacing from leader (g-1)/2
+        T target_drag = params.gpk*(mouse_pos-pos.col(0)).norm();
+        acc.col(0) += (target_drag > params.max_drag ? params.max_drag : target_drag)*(mouse_pos-pos.col(0)).normalized();
+        acc.col(0) += 0.5*params.gdk*(-vel.col(0));
+        for(int g=1;g<leaders;g++)
+        {
+            const int parent = (g-1)/2;
+            using std::acos; using std::cos; using std::sin;
+            const T angle = 2*acos(T(-1))*g/leaders;
+            TV target = image(pos.col(g), pos.col(parent)) + params.leader_spacing*planarVector<T, dim>(cos(angle), sin(angle));
+            T drag = params.gpk*(target-pos.col(g)).norm();
+            acc.col(g) += (drag > params.max_drag ? params.max_drag : drag)*(target-pos.col(g)).normalized();
+            acc.col(g) += 0.3*params.gdk*(vel.col(parent)-vel.col(g));
+        }
+        return acc;
+    }
+    // checks the next n/regroup_steps followers, one that is much nearer to another leader changes group
+    void regroup()
+    {
+        PROFILE_SCOPE("regroup");
+        const int leaders = int(group_start.size()) - 1;
+        const int followers = n - leaders;
+        if(followers <= 0) return;
+        const int checks = (followers + params.regroup_steps - 1)/std::max(params.regroup_steps, 1);
+        bool moved = false;
+        for(int c=0;c<checks;c++)
+        {
+            if(regroup_cursor >= followers) regroup_cursor = 0;
+            int i = leaders + regroup_cursor++;
+            int own = int(std::upper_bound(group_start.begin(), group_start.end(), i) - group_start.begin()) - 1;
+            int nearest = nearestLeader(positions.col(i), leaders);
+            // hysteresis, boids between two leaders do not flip back and forth
+            const TV p = positions.col(i);
+            if(nearest == own || (image(p, positions.col(nearest))-p).norm() > T(0.7)*(image(p, positions.col(own))-p).norm())
+                continue;
+            moveFollower(i, own, nearest);
+            moved = true;
+            regrouped++;
+        }
+        if(moved) integrator_state.invalidate(); // cached accelerations belong to the old columns
+    }
+    // moves the follower in column i from group a to group b, one swap per group boundary in between
+    void moveFollower(int i, int a, int b)
+    {
+        while(a < b)
+        {
+            int last = group_start[a+1]-1;
+            swapBoids(i, last);
+            i = last;
+            group_start[a+1]--;
+            a++;
+        }
+        while(a > b)
+        {
+            int first = group_start[a];
+            swapBoids(i, first);
+            i = first;
+            group_start[a]++;
+            a--;
+        }
+    }
+    void swapBoids(int i, int j)
+    {
+        if(i == j) return;
+        positions.col(i).swap(positions.col(j));
+        velocities.col(i).swap(velocities.col(j));
+        if(int(awake.size()) == n)
+        {
+            std::swap(awake[i], awake[j]);
+            std::swap(calm_steps[i], calm_steps[j]);
+            calm_pos.col(i).swap(calm_pos.col(j));
+            calm_vel.col(i).swap(calm_vel.col(j));
         }
     }
+    // signed distance to the obstacles of COLLISION_AVOID in the xy-plane, for the flow field
+    T obstacleDistance(const Vector<T, 2>& p) const
+    {
+        if(params.obstacles.empty()) return (p-params.obs_pos.template head<2>()).norm() - params.obs_radius;
+        T x;
+        Vector<T, 2> gradient;
+        if(!obstacle_field.sample(p, x, gradient)) return std::numeric_limits<T>::infinity();
+        return x;
+    }
+    void prepareFlow()
+    {
+        if(flow_valid || !params.flow_field) return;
+        PROFILE_SCOPE("flow field");
+        flow.build(params.fixed_goal_pos.template head<2>(), params.flow_extent, params.flow_cell, params.flow_clearance,
+                   [this](const Vector<T, 2>& p) { return obstacleDistance(p); });
+        flow_valid = true;
+    }
+    // unit vector towards the goal: along the flow field in the xy-plane, straight where the field has no path
+    TV goalDirection(const TV& p) const
+    {
+        TV dir = (params.fixed_goal_pos-p).normalized();
+        Vector<T, 2> planar;
+        if(flow.direction(p.template head<2>(), planar)) dir.template head<2>() = planar*dir.template head<2>().norm();
+        return dir;
+    }
+    // repulsion of params.obstacles at p, the single obstacle force with the distance and direction from the field
+    TV fieldRepulsion(const TV& p) const
+    {
+        TV acc = TV::Zero();
+        T x;
+        Vector<T, 2> gradient;
+        if(!obstacle_field.sample(p.template head<2>(), x, gradient) || x > params.eyesight_range) return acc;
+        T norm = gradient.norm();
+        if(norm == 0) return acc;
+        T push = params.ok*pow(params.obs_effect_band, -params.obs_repel_power);
+        if(x < params.obs_effect_band) push += params.ok*pow(std::max(x, T(0.01)*params.obs_effect_band), -params.obs_repel_power);
+        acc.template head<2>() = push*gradient/norm;
+        return acc;
+    }
+// fraction of the boids that sleep, 0 unless params.sleeping
+    T getSleepingFraction() const
+    {
+        return n > 0 ? T(sleeping_count)/n : T(0);
+    }
+// per boid, 0 while it sleeps
+    const std::vector<char>& getAwake() const
+    {
+        return awake;
+    }
     void pause()
     {
         update = !update;
@@ -524,29 +1208,126 @@ public:
     {
         return velocities;
     }
-    float get_obs_radius()
+    T get_obs_radius()
     {
-        return obs_radius;
+        return params.obs_radius;
     }
     TV get_obs_pos()
     {
-        return obs_pos;
+        return params.obs_pos;
+    }
+    const std::vector<Obstacle<T>>& getObstacles() const
+    {
+        return params.obstacles;
+    }
+    // moves obstacle k of params.obstacles, the distance field is updated around its old and new place
+    void moveObstacle(int k, const Vector<T, 2>& center)
+    {
+        Vector<T, 2> old_lo, old_hi, lo, hi;
+        params.obstacles[k].bounds(old_lo, old_hi);
+        params.obstacles[k].center = center;
+        params.obstacles[k].bounds(lo, hi);
+        if(field_valid && !obstacle_field.move(k, center)) flow_valid = false; // the whole field changed
+        if(flow_valid)
+        {
+            PROFILE_SCOPE("flow field");
+            // the bilinear lookup spreads the change of the distance by one field cell
+            const T margin = params.field_cell;
+            flow.update(old_lo.cwiseMin(lo).array()-margin, old_hi.cwiseMax(hi).array()+margin,
+                        [this](const Vector<T, 2>& p) { return obstacleDistance(p); });
+        }
+        // no moving boid comes near a settled flock, the obstacle has to wake the boids that see it come or go
+        if(params.sleeping && sleeping_count > 0) wakeNear(old_lo.cwiseMin(lo), old_hi.cwiseMax(hi), params.eyesight_range);
+    }
+    const FlowField<T>& getFlowField() const
+    {
+        return flow;
+    }
+    // LEADER with params.leaders > 1: columns of the followers of every leader, empty otherwise
+    const std::vector<int>& getGroupStart() const
+    {
+        return group_start;
+    }
+    long long getRegrouped() const
+    {
+        return regrouped;
+    }
+    void setThreadPool(ThreadPool* pool)
+    {
+        this->pool = pool;
+    }
+    const ObstacleField<T>& getObstacleField() const
+    {
+        return obstacle_field;
     }
     TV get_goal_pos()
     {
-        return fixed_goal_pos;
+        return params.fixed_goal_pos;
     }
     void getMousePos(TV msPos)
     {
         mouse_pos = msPos;
     }
+// the live boids of the teams, in slot order with a population cap
     TVStack get_A_pos()
     {
-        return A_pos;
+        return pooled ? liveColumns(A_pos, A_slots) : A_pos;
     }
     TVStack get_B_pos()
     {
-        return B_pos;
+        return pooled ? liveColumns(B_pos, B_slots) : B_pos;
+    }
+    TVStack get_A_vel()
+    {
+        return pooled ? liveColumns(A_vel, A_slots) : A_vel;
+    }
+    TVStack get_B_vel()
+    {
+        return pooled ? liveColumns(B_vel, B_slots) : B_vel;
+    }
+    int get_A_count() const
+    {
+        return pooled ? A_slots.size() : int(A_pos.cols());
+    }
+    int get_B_count() const
+    {
+        return pooled ? B_slots.size() : int(B_pos.cols());
+    }
+    // columns of the team matrices, the slot pool capacity with a population cap
+    int getTeamColumns() const
+    {
+        return int(A_pos.cols() + B_pos.cols());
+    }
+    long long getForceEvaluations()
+    {
+        return force_evals;
+    }
+    long long getWideEvaluations()
+    {
+        return wide_evals;
+    }
+    // solves and conjugate gradient iterations of the implicit repulsion
+    const RepulsionSolver<T, dim>& getRepulsionSolver() const
+    {
+        return repulsion_solver;
+    }
+    // simulated time, step sizes and accepted/rejected steps of the integrator
+    const IntegratorState<T, dim>& getIntegratorState() const
+    {
+        return integrator_state;
+    }
+    T getTime() const
+    {
+        return integrator_state.time;
+    }
+    int getStep()
+    {
+        return cnt;
+    }
+    // a CA_BEHAVE game is decided when one of the teams is wiped out
+    bool isDecided()
+    {
+        return get_A_count() == 0 || get_B_count() == 0;
     }
 
 };
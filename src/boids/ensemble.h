@@ -0,0 +1,105 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+#include <chrono>
+#include <vector>
+#include "scenario.h"
+#include "thread_pool.h"
+
+// Many independent small CA_BEHAVE games in one process. The games are
+// stepped together in rounds of sync_steps on a thread pool, finished games
+// drop out of the next round. Per-game results are kept as one array per field.
+// The games themselves stay whole Boids, not one structure of arrays across
+// games: a game is stepped by one thread from start to end, its positions and
+// velocities are already contiguous matrices that the CA kernels run over, and
+// games shrink at different rates as boids die, which a shared array would
+// have to compact every step.
+
+struct EnsembleStats
+{
+    int games = 0;
+    int wins_A = 0;        // team B wiped out
+    int wins_B = 0;        // team A wiped out
+    int draws = 0;         // both wiped out, or still undecided after max_steps
+    double mean_steps = 0;
+    double seconds = 0;
+
+    double gamesPerSecond() const { return seconds > 0 ? games/seconds : 0; }
+};
+
+template <class T, int dim>
+class Ensemble
+{
+public:
+    // game k uses seed scenario.seed + k
+    Ensemble(const Scenario<T, dim>& scenario, int games)
+    {
+        BoidsParams<T, dim> params = scenario.params;
+        params.verbose = false;
+        boids.reserve(games);
+        for(int k=0;k<games;k++)
+        {
+            boids.emplace_back(scenario.boid_number, params);
+            boids[k].seed(scenario.seed + k);
+            boids[k].initializePositions(CA_BEHAVE);
+            boids[k].pause();
+        }
+        steps.assign(games, 0);
+        A_count.assign(games, int(scenario.boid_number/2));
+        B_count.assign(games, int(scenario.boid_number/2));
+        finished.assign(games, 0);
+    }
+
+    int size() const { return int(boids.size()); }
+
+    EnsembleStats run(ThreadPool& pool, int max_steps, int sync_steps = 1000)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<int> active;
+        for(int k=0;k<size();k++) if(!finished[k]) active.push_back(k);
+
+        while(!active.empty())
+        {
+            pool.parallelFor(0, int(active.size()), [&](int a, int) {
+                PROFILE_SCOPE("ensemble game");
+                int k = active[a];
+                Boids<T, dim>& game = boids[k];
+                for(int s=0;s<sync_steps && steps[k]<max_steps && !game.isDecided();s++)
+                {
+                    game.updateBehavior(CA_BEHAVE);
+                    steps[k]++;
+                }
+                A_count[k] = game.get_A_count();
+                B_count[k] = game.get_B_count();
+                finished[k] = game.isDecided() || steps[k] >= max_steps;
+            });
+            std::vector<int> still_active;
+            for(int k : active) if(!finished[k]) still_active.push_back(k);
+            active.swap(still_active);
+        }
+
+        EnsembleStats stats;
+        stats.games = size();
+        for(int k=0;k<size();k++)
+        {
+            if(A_count[k] > 0 && B_count[k] == 0) stats.wins_A++;
+            else if(B_count[k] > 0 && A_count[k] == 0) stats.wins_B++;
+            else stats.draws++;
+            stats.mean_steps += steps[k];
+        }
+        if(stats.games > 0) stats.mean_steps /= stats.games;
+        stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-start).count();
+        return stats;
+    }
+
+    int getSteps(int k) const { return steps[k]; }
+    int get_A_count(int k) const { return A_count[k]; }
+    int get_B_count(int k) const { return B_count[k]; }
+
+private:
+    std::vector<Boids<T, dim>> boids;
+    std::vector<int> steps;
+    std::vector<int> A_count;
+    std::vector<int> B_count;
+    std::vector<char> finished;
+};
+#endif
@@ -0,0 +1,238 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+#include <Eigen/Core>
+
+// Q16.16 fixed-point scalar of the deterministic mode, Boids<fixed32, dim>.
+// Every operation is integer arithmetic (sqrt goes through the correctly
+// rounded double sqrt), so a run gives the same bits on every x86-64 build,
+// at any optimization level, vector width and thread count: float results
+// move with FMA contraction, the order of vectorized sums and the libm.
+// Sums are exact, so they do not depend on the order either.
+// Range +-32768, resolution 2^-16; overflow wraps, division by zero saturates.
+
+class fixed32
+{
+public:
+    static constexpr int frac_bits = 16;
+    static constexpr int32_t one = 1 << frac_bits;
+
+    fixed32() = default;
+    template <class I, typename std::enable_if<std::is_integral<I>::value, int>::type = 0>
+    fixed32(I v) : raw(int32_t(int64_t(v)*one)) {}
+    template <class F, typename std::enable_if<std::is_floating_point<F>::value, int>::type = 0>
+    fixed32(F v) : raw(int32_t(nearest(double(v)*one))) {}
+
+    static fixed32 fromRaw(int32_t bits) { fixed32 x; x.raw = bits; return x; }
+    int32_t bits() const { return raw; }
+
+    explicit operator float() const { return float(raw)*(1.f/one); }
+    explicit operator double() const { return double(raw)*(1./one); }
+    // truncates towards zero like a float does
+    template <class I, typename std::enable_if<std::is_integral<I>::value, int>::type = 0>
+    explicit operator I() const { return I(raw/one); }
+
+    fixed32 operator+() const { return *this; }
+    fixed32 operator-() const { return fromRaw(int32_t(0u - uint32_t(raw))); }
+    fixed32& operator+=(fixed32 b) { raw = int32_t(uint32_t(raw) + uint32_t(b.raw)); return *this; }
+    fixed32& operator-=(fixed32 b) { raw = int32_t(uint32_t(raw) - uint32_t(b.raw)); return *this; }
+    fixed32& operator*=(fixed32 b) { raw = int32_t((int64_t(raw)*b.raw + one/2) >> frac_bits); return *this; }
+    fixed32& operator/=(fixed32 b)
+    {
+        if(b.raw == 0) raw = raw < 0 ? std::numeric_limits<int32_t>::min() : std::numeric_limits<int32_t>::max();
+        else raw = int32_t(int64_t(raw)*one/b.raw);
+        return *this;
+    }
+
+    friend fixed32 operator+(fixed32 a, fixed32 b) { return a += b; }
+    friend fixed32 operator-(fixed32 a, fixed32 b) { return a -= b; }
+    friend fixed32 operator*(fixed32 a, fixed32 b) { return a *= b; }
+    friend fixed32 operator/(fixed32 a, fixed32 b) { return a /= b; }
+    friend bool operator==(fixed32 a, fixed32 b) { return a.raw == b.raw; }
+    friend bool operator!=(fixed32 a, fixed32 b) { return a.raw != b.raw; }
+    friend bool operator<(fixed32 a, fixed32 b) { return a.raw < b.raw; }
+    friend bool operator<=(fixed32 a, fixed32 b) { return a.raw <= b.raw; }
+    friend bool operator>(fixed32 a, fixed32 b) { return a.raw > b.raw; }
+    friend bool operator>=(fixed32 a, fixed32 b) { return a.raw >= b.raw; }
+    friend std::ostream& operator<<(std::ostream& out, fixed32 x) { return out << double(x); }
+
+private:
+    // round half away from zero, inline (llrint is a libm call); d*one is exact, so is the sum
+    static int64_t nearest(double d) { return int64_t(d < 0 ? d - 0.5 : d + 0.5); }
+
+    int32_t raw;
+};
+
+namespace std
+{
+    template <>
+    class numeric_limits<fixed32>
+    {
+    public:
+        static constexpr bool is_specialized = true;
+        static constexpr bool is_signed = true;
+        static constexpr bool is_integer = false;
+        static constexpr bool is_exact = true;
+        static constexpr bool has_infinity = false;
+        static constexpr bool has_quiet_NaN = false;
+        static constexpr int digits = 31;
+        static constexpr int digits10 = 4;
+        static fixed32 min() { return fixed32::fromRaw(1); }
+        static fixed32 max() { return fixed32::fromRaw(numeric_limits<int32_t>::max()); }
+        static fixed32 lowest() { return fixed32::fromRaw(numeric_limits<int32_t>::min()); }
+        static fixed32 epsilon() { return fixed32::fromRaw(1); }
+        static fixed32 round_error() { return fixed32::fromRaw(fixed32::one/2); }
+        static fixed32 infinity() { return max(); } // the largest value stands in, nothing is farther
+        static fixed32 quiet_NaN() { return fixed32(0); }
+    };
+}
+
+// the math functions of the kernels, integer arithmetic in Q30 where they need the precision
+namespace fixed_math
+{
+    const int64_t one30 = int64_t(1) << 30;
+    const int64_t pi30 = 3373259426;      // pi in Q30
+    const int64_t half_pi30 = 1686629713;
+
+    inline int64_t toQ30(fixed32 x) { return int64_t(x.bits())*(one30 >> fixed32::frac_bits); }
+
+    inline int64_t mul30(int64_t a, int64_t b) { return (a*b) >> 30; }
+
+    inline fixed32 fromQ30(int64_t x) { return fixed32::fromRaw(int32_t((x + (one30 >> (fixed32::frac_bits+1))) >> (30 - fixed32::frac_bits))); }
+
+    // sin of the Q30 angle a, in Q30
+    inline int64_t sin30(int64_t a)
+    {
+        a %= 2*pi30;
+        if(a > pi30) a -= 2*pi30;
+        if(a < -pi30) a += 2*pi30;
+        if(a > half_pi30) a = pi30 - a;
+        if(a < -half_pi30) a = -pi30 - a;
+        // taylor series to x^11, below 4e-8 on [-pi/2, pi/2]
+        const int64_t a2 = mul30(a, a);
+        int64_t t = one30 - a2/110;
+        t = one30 - mul30(a2, t)/72;
+        t = one30 - mul30(a2, t)/42;
+        t = one30 - mul30(a2, t)/20;
+        t = one30 - mul30(a2, t)/6;
+        return mul30(a, t);
+    }
+
+    // powers 2^(2^-i) in Q30, i = 1..16
+    const int64_t exp2_bits[16] = {1518500250, 1276901417, 1170923762, 1121280436, 1097253708, 1085434106, 1079572136, 1076653033,
+                                   1075196443, 1074468888, 1074105294, 1073923544, 1073832680, 1073787251, 1073764537, 1073753181};
+
+    // x > 0
+    inline fixed32 log2(fixed32 x)
+    {
+        // x = m/2^30 * 2^e with m in [2^30, 2^31)
+        int64_t m = x.bits();
+        int e = 30 - fixed32::frac_bits;
+        while(m < one30) { m <<= 1; e--; }
+        while(m >= 2*one30) { m >>= 1; e++; }
+        int32_t result = e*fixed32::one;
+        for(int32_t bit=fixed32::one/2;bit>0;bit/=2)
+        {
+            m = mul30(m, m);
+            if(m >= 2*one30)
+            {
+                m >>= 1;
+                result += bit;
+            }
+        }
+        return fixed32::fromRaw(result);
+    }
+
+    inline fixed32 exp2(fixed32 y)
+    {
+        const int k = y.bits() >> fixed32::frac_bits; // floor
+        const int32_t f = y.bits() & (fixed32::one-1);
+        int64_t m = one30;
+        for(int i=0;i<fixed32::frac_bits;i++)
+            if(f & (fixed32::one >> (i+1))) m = mul30(m, exp2_bits[i]);
+        const int shift = k - (30 - fixed32::frac_bits);
+        if(shift >= 0) return shift > 0 ? std::numeric_limits<fixed32>::max() : fixed32::fromRaw(int32_t(m));
+        if(shift < -40) return fixed32(0);
+        return fixed32::fromRaw(int32_t((m + (int64_t(1) << (-shift-1))) >> -shift));
+    }
+}
+
+// the math of the kernels, found by argument lookup from Eigen and the kernels' using std::sqrt; sqrt(x) calls
+inline fixed32 abs(fixed32 x) { return x < 0 ? -x : x; }
+inline fixed32 floor(fixed32 x) { return fixed32::fromRaw(x.bits() & ~(fixed32::one-1)); }
+inline fixed32 ceil(fixed32 x) { return -floor(-x); }
+inline fixed32 round(fixed32 x) { return x < 0 ? -floor(fixed32::fromRaw(fixed32::one/2) - x) : floor(x + fixed32::fromRaw(fixed32::one/2)); }
+inline long lround(fixed32 x) { return long(round(x)); }
+inline fixed32 sqrt(fixed32 x)
+{
+    if(x.bits() <= 0) return fixed32(0);
+    return fixed32::fromRaw(int32_t(std::sqrt(double(x.bits())*fixed32::one) + 0.5));
+}
+inline fixed32 pow(fixed32 x, fixed32 y)
+{
+    if(y == 0) return fixed32(1);
+    if(x.bits() <= 0) return fixed32(0);
+    return fixed_math::exp2(y*fixed_math::log2(x));
+}
+inline fixed32 sin(fixed32 x) { return fixed_math::fromQ30(fixed_math::sin30(fixed_math::toQ30(x))); }
+inline fixed32 cos(fixed32 x) { return fixed_math::fromQ30(fixed_math::sin30(fixed_math::toQ30(x) + fixed_math::half_pi30)); }
+inline fixed32 acos(fixed32 x)
+{
+    const fixed32 pi = fixed_math::fromQ30(fixed_math::pi30);
+    if(x <= -1) return pi;
+    if(x >= 1) return fixed32(0);
+    // cos falls on [0, pi], bisect the angle against cos in Q30
+    const int64_t c = fixed_math::toQ30(x);
+    int32_t lo = 0, hi = pi.bits();
+    while(lo < hi)
+    {
+        const int32_t mid = lo + (hi-lo)/2;
+        if(fixed_math::sin30(fixed_math::toQ30(fixed32::fromRaw(mid)) + fixed_math::half_pi30) > c) lo = mid+1;
+        else hi = mid;
+    }
+    return fixed32::fromRaw(lo);
+}
+inline bool isfinite(fixed32) { return true; }
+inline bool isinf(fixed32) { return false; }
+inline bool isnan(fixed32) { return false; }
+
+// lets Eigen store fixed32 (no vectorization, the kernels are scalar)
+namespace Eigen
+{
+    template <>
+    struct NumTraits<fixed32> : GenericNumTraits<fixed32>
+    {
+        typedef fixed32 Real;
+        typedef fixed32 NonInteger;
+        typedef fixed32 Literal;
+        typedef fixed32 Nested;
+        enum { IsComplex = 0, IsInteger = 0, IsSigned = 1, RequireInitialization = 0, ReadCost = 1, AddCost = 1, MulCost = 2 };
+        static fixed32 epsilon() { return fixed32::fromRaw(1); }
+        static fixed32 dummy_precision() { return fixed32::fromRaw(16); }
+        static fixed32 highest() { return std::numeric_limits<fixed32>::max(); }
+        static fixed32 lowest() { return std::numeric_limits<fixed32>::lowest(); }
+        static int digits10() { return 4; }
+    };
+}
+
+// FNV-1a over the raw bits of fixed-point states, for comparing runs
+template <int dim>
+uint64_t stateHash(const std::vector<Eigen::Matrix<fixed32, dim, Eigen::Dynamic>>& states)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(const Eigen::Matrix<fixed32, dim, Eigen::Dynamic>& state : states)
+    {
+        for(int k=0;k<state.size();k++)
+        {
+            hash ^= uint32_t(state(k).bits());
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+#endif
@@ -0,0 +1,237 @@
+#ifndef FLOW_FIELD_H
+#define FLOW_FIELD_H
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+
+// Navigation flow field towards one goal, shared by all boids. A grid over
+// [-extent, extent]^2 marks the nodes closer than clearance to an obstacle as
+// blocked, a Dijkstra distance transform from the goal (8 neighbors, no
+// corner cutting past blocked nodes) gives every free node its path length to
+// the goal and the neighbor it came from. direction() blends the directions
+// to those neighbors of the 4 nodes around a point: an O(1) lookup.
+// When obstacles move, update() re-marks the nodes of the changed box,
+// invalidates the paths that ran through newly blocked nodes and repairs the
+// distances from the border of the invalidated region and the freed nodes,
+// instead of running the whole transform again.
+
+template <class T>
+class FlowField
+{
+public:
+    typedef Eigen::Matrix<T, 2, 1> V2;
+    typedef std::function<T(const V2&)> DistanceFunction; // signed distance to the obstacles
+
+    void build(const V2& goal, T extent, T cell, T clearance, const DistanceFunction& obstacles)
+    {
+        this->cell = cell;
+        this->clearance = clearance;
+        using std::ceil;
+        origin = V2(-extent, -extent);
+        nx = ny = int(ceil(2*extent/cell)) + 1;
+        const size_t nodes = size_t(nx)*ny;
+        blocked.assign(nodes, 0);
+        distance.assign(nodes, infinity());
+        parent.assign(nodes, -1);
+        for(int y=0;y<ny;y++)
+            for(int x=0;x<nx;x++) blocked[y*nx + x] = obstacles(position(x, y)) < clearance;
+
+        goal_node = nearestNode(goal);
+        this->goal = goal;
+        std::vector<int> seeds;
+        if(goal_node >= 0 && !blocked[goal_node])
+        {
+            distance[goal_node] = 0;
+            parent[goal_node] = goal_node;
+            seeds.push_back(goal_node);
+        }
+        relax(seeds);
+        builds++;
+    }
+
+    // re-marks the nodes within clearance of the box [lo, hi], where the obstacle distance changed, and repairs the distances
+    void update(const V2& lo, const V2& hi, const DistanceFunction& obstacles)
+    {
+        if(nx == 0) return;
+        using std::floor; using std::ceil;
+        int x0 = std::max(int(floor((lo[0]-clearance-origin[0])/cell)), 0);
+        int y0 = std::max(int(floor((lo[1]-clearance-origin[1])/cell)), 0);
+        int x1 = std::min(int(ceil((hi[0]+clearance-origin[0])/cell)), nx-1);
+        int y1 = std::min(int(ceil((hi[1]+clearance-origin[1])/cell)), ny-1);
+        std::vector<int> invalid, freed;
+        for(int y=y0;y<=y1;y++)
+        {
+            for(int x=x0;x<=x1;x++)
+            {
+                const int k = y*nx + x;
+                const char now = obstacles(position(x, y)) < clearance;
+                if(now == blocked[k]) continue;
+                blocked[k] = now;
+                if(now) invalid.push_back(k);
+                else freed.push_back(k);
+            }
+        }
+        if(invalid.empty() && freed.empty()) return;
+
+        // diagonal steps past the corner of a newly blocked node are cut
+        const size_t newly_blocked = invalid.size();
+        for(size_t q=0;q<newly_blocked;q++)
+        {
+            const int c = invalid[q];
+            forEachAdjacent(c, [&](int l) {
+                const int p = parent[l];
+                if(p < 0 || l == goal_node || blocked[l]) return;
+                const int dx = p%nx - l%nx, dy = p/nx - l/nx;
+                if(dx != 0 && dy != 0 && (l+dx == c || l+dy*nx == c))
+                {
+                    parent[l] = -1;
+                    invalid.push_back(l);
+                }
+            });
+        }
+        // every node whose path ran through an invalid node loses its distance
+        for(size_t q=0;q<invalid.size();q++)
+        {
+            const int k = invalid[q];
+            distance[k] = infinity();
+            parent[k] = -1;
+            forEachAdjacent(k, [&](int l) {
+                if(parent[l] == k && l != goal_node)
+                {
+                    parent[l] = -1;
+                    invalid.push_back(l);
+                }
+            });
+        }
+        // the free nodes around the holes and the freed nodes restart the transform
+        std::vector<int> seeds;
+        auto seedAround = [&](int k) {
+            forEachNeighbor(k, [&](int l, T) {
+                if(!blocked[l] && distance[l] < infinity()) seeds.push_back(l);
+            });
+        };
+        for(int k : invalid) seedAround(k);
+        for(int k : freed) seedAround(k);
+        if(goal_node >= 0 && !blocked[goal_node] && distance[goal_node] != 0)
+        {
+            distance[goal_node] = 0;
+            parent[goal_node] = goal_node;
+            seeds.push_back(goal_node);
+        }
+        relax(seeds);
+        updates++;
+    }
+
+    // unit direction towards the goal along the field at p, false outside the field or where no path is known
+    bool direction(const V2& p, V2& dir) const
+    {
+        const T fx = (p[0]-origin[0])/cell, fy = (p[1]-origin[1])/cell;
+        if(!(fx >= 0 && fy >= 0 && fx < nx-1 && fy < ny-1)) return false;
+        const int x = int(fx), y = int(fy);
+        const T u = fx-x, v = fy-y;
+        const int k = y*nx + x;
+        dir = (1-u)*(1-v)*step(k) + u*(1-v)*step(k+1) + (1-u)*v*step(k+nx) + u*v*step(k+nx+1);
+        const T norm = dir.norm();
+        if(norm < T(1e-6)) return false;
+        dir /= norm;
+        return true;
+    }
+
+    // path length from p's nearest node to the goal, infinity when blocked or unreachable
+    T pathLength(const V2& p) const
+    {
+        int k = nearestNode(p);
+        return k < 0 ? infinity() : distance[k];
+    }
+
+    int nodeCount() const { return nx*ny; }
+    long long builds = 0;
+    long long updates = 0;
+    long long relaxed = 0;  // nodes settled by the transform, summed over builds and updates
+
+private:
+    static T infinity() { return std::numeric_limits<T>::infinity(); }
+
+    V2 position(int x, int y) const { return origin + cell*V2(T(x), T(y)); }
+
+    int nearestNode(const V2& p) const
+    {
+        using std::lround;
+        const int x = int(lround((p[0]-origin[0])/cell)), y = int(lround((p[1]-origin[1])/cell));
+        if(x < 0 || y < 0 || x >= nx || y >= ny) return -1;
+        return y*nx + x;
+    }
+
+    // unit vector from node k towards its parent, zero for blocked, unreachable and goal nodes
+    V2 step(int k) const
+    {
+        if(k == goal_node) return (goal-position(k%nx, k/nx)).normalized();
+        if(parent[k] < 0) return V2::Zero();
+        const int dx = parent[k]%nx - k%nx, dy = parent[k]/nx - k/nx;
+        return V2(T(dx), T(dy)).normalized();
+    }
+
+    // fn(l) for the 8 nodes around node k
+    template <class Fn>
+    void forEachAdjacent(int k, Fn&& fn) const
+    {
+        const int x = k%nx, y = k/nx;
+        for(int dy=-1;dy<=1;dy++)
+            for(int dx=-1;dx<=1;dx++)
+                if((dx != 0 || dy != 0) && x+dx >= 0 && y+dy >= 0 && x+dx < nx && y+dy < ny) fn(k + dy*nx + dx);
+    }
+
+    // fn(l, length of the step) for the neighbors of node k a path may step to, diagonals only past free corners
+    template <class Fn>
+    void forEachNeighbor(int k, Fn&& fn) const
+    {
+        const int x = k%nx, y = k/nx;
+        for(int dy=-1;dy<=1;dy++)
+        {
+            for(int dx=-1;dx<=1;dx++)
+            {
+                if((dx == 0 && dy == 0) || x+dx < 0 || y+dy < 0 || x+dx >= nx || y+dy >= ny) continue;
+                if(dx != 0 && dy != 0 && (blocked[k+dx] || blocked[k+dy*nx])) continue;
+                fn(k + dy*nx + dx, dx != 0 && dy != 0 ? T(std::sqrt(2.))*cell : cell);
+            }
+        }
+    }
+
+    // dijkstra from the seeds, whose distances are final or upper bounds
+    void relax(const std::vector<int>& seeds)
+    {
+        typedef std::pair<T, int> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        for(int k : seeds) queue.emplace(distance[k], k);
+        while(!queue.empty())
+        {
+            Entry top = queue.top();
+            queue.pop();
+            const int k = top.second;
+            if(top.first > distance[k]) continue; // stale entry
+            relaxed++;
+            forEachNeighbor(k, [&](int l, T length) {
+                if(blocked[l] || distance[k] + length >= distance[l]) return;
+                distance[l] = distance[k] + length;
+                parent[l] = k;
+                queue.emplace(distance[l], l);
+            });
+        }
+    }
+
+    V2 origin = V2::Zero();
+    V2 goal = V2::Zero();
+    T cell = 0.02;
+    T clearance = 0;
+    int nx = 0, ny = 0;
+    int goal_node = -1;
+    std::vector<char> blocked;
+    std::vector<T> distance;  // path length to the goal, row major like ObstacleField
+    std::vector<int> parent;  // next node on the path, the goal is its own parent, -1 without a path
+};
+#endif
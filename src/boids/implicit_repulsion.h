@@ -0,0 +1,95 @@
+#ifndef IMPLICIT_REPULSION_H
+#define IMPLICIT_REPULSION_H
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
+#include "periodic.h"
+#include "spatial_grid.h"
+
+// Semi-implicit velocity change of the separation springs. Inside repel_radius
+// boid i feels k*(x_i - x_j), summed over its pairs that is k*L*x, with L the
+// graph laplacian of the pairs. Explicitly, one step adds h*k*L*x to the
+// velocities, which overshoots the cut-off once h*h*k is not small.
+// The spring pushes apart, so a backward euler step (I - h*h*k*L) would make
+// it stronger and loses definiteness exactly at large h. The step here solves
+//     (I + h*h*k*L) dv = h*k*L*x
+// instead, the implicit form of a spring of the same stiffness: for small h it
+// is the explicit kick, for large h every pair separates by at most its
+// distance per step. The matrix is symmetric positive definite, a few
+// conjugate gradient iterations from dv = rhs are enough.
+// The pairs come from a neighbor grid at radius, as in the explicit force
+// loops. L*x is summed pair by pair over x_i - x_j of the minimum images, so
+// in a periodic box a pair across the seam springs like any other.
+
+template <class T, int dim>
+class RepulsionSolver
+{
+public:
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, dim> StackT;  // one column per coordinate for the solver
+
+    // velocity change of all boids in pos, k = repulsion gain, period > 0 for a periodic box,
+    // live: only the boids marked there spring (slot pools)
+    TVStack solve(const TVStack& pos, T radius, T k, T h, int max_iterations, T tolerance, T period = 0,
+                  const std::vector<char>* live = nullptr)
+    {
+        const int n = int(pos.cols());
+        if(n == 0) return TVStack::Zero(dim, 0);
+        buildSystem(pos, radius, h*h*k, period, live);
+        if(pairs == 0) return TVStack::Zero(dim, n);
+
+        StackT rhs = h*k*spring;
+        Eigen::ConjugateGradient<Eigen::SparseMatrix<T>, Eigen::Lower|Eigen::Upper> cg;
+        cg.setMaxIterations(max_iterations);
+        cg.setTolerance(tolerance);
+        cg.compute(system);
+        StackT dv = cg.solveWithGuess(rhs, rhs);
+        solves++;
+        iterations += cg.iterations();
+        return dv.transpose();
+    }
+
+    long long solves = 0;
+    long long iterations = 0;   // summed over the solves, of the last coordinate column
+    int pairs = 0;              // pairs of the last solve
+
+private:
+    // system = I + stiffness*L and spring = L*x, one row per boid
+    void buildSystem(const TVStack& pos, T radius, T stiffness, T period, const std::vector<char>* live)
+    {
+        const int n = int(pos.cols());
+        triplets.clear();
+        std::vector<T> degree(n, T(0));
+        spring = StackT::Zero(n, dim);
+        pairs = 0;
+        grid.build(pos, radius, period);
+        for(int i=0;i<n;i++)
+        {
+            if(live && !(*live)[i]) continue;
+            grid.forEachNear(pos.col(i), radius, [&](int j)
+            {
+                if(j <= i || (live && !(*live)[j])) return;
+                Eigen::Matrix<T, dim, 1> d = pos.col(i)-pos.col(j);
+                if(period > 0) for(int a=0;a<dim;a++) d[a] = minimumImage(d[a], period);
+                if(d.norm() > radius) return;
+                triplets.emplace_back(i, j, -stiffness);
+                triplets.emplace_back(j, i, -stiffness);
+                degree[i] += 1;
+                degree[j] += 1;
+                spring.row(i) += d.transpose();
+                spring.row(j) -= d.transpose();
+                pairs++;
+            });
+        }
+        for(int i=0;i<n;i++) triplets.emplace_back(i, i, T(1) + stiffness*degree[i]);
+        system.resize(n, n);
+        system.setFromTriplets(triplets.begin(), triplets.end());
+    }
+
+    SpatialGrid<T, dim> grid;
+    std::vector<Eigen::Triplet<T>> triplets; // kept to reuse the allocation
+    Eigen::SparseMatrix<T> system;
+    StackT spring;
+};
+#endif
@@ -0,0 +1,346 @@
+#ifndef INTEGRATORS_H
+#define INTEGRATORS_H
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <Eigen/Core>
+#include "profiler.h"
+
+// Time integrators of the flocking methods, picked by BoidsParams::updateMode.
+// An integrator advances pos and vel by one step h and returns the number of
+// force evaluations it spent, so schemes can be compared at equal cost:
+//   0 basic euler         1 eval, first order
+//   1 symplectic euler    1 eval, first order, keeps orbits bounded
+//   2 explicit midpoint   2 evals, second order
+//   3 velocity verlet     1 eval, second order, reuses the last step's acceleration
+//   4 rk4                 4 evals, fourth order
+//   5 adaptive            3 evals per try, bogacki-shampine 3(2), picks its own step
+//   6 multirate           1 fast eval, every respa_steps steps 1 slow eval (r-RESPA)
+// Integrators are stateless, whatever has to survive a step (the cached
+// acceleration of velocity verlet, the step size of the adaptive scheme)
+// lives in IntegratorState, owned by Boids.
+
+enum IntegratorTypes
+{
+    BASIC_EULER=0, SYMPLECTIC_EULER=1, EXPLICIT_MIDPOINT=2, VELOCITY_VERLET=3, RK4=4, ADAPTIVE=5, MULTIRATE=6
+};
+
+// force terms an evaluation computes. SLOW_FORCES are the wide-radius
+// cohesion/alignment sums, FAST_FORCES the short-range REPULSION plus the
+// obstacle, goal, damping, wall and external EXTERNAL_FORCES.
+enum ForceParts
+{
+    SLOW_FORCES=1, REPULSION=2, EXTERNAL_FORCES=4, FAST_FORCES=6, ALL_FORCES=7
+};
+
+template <class T, int dim>
+struct IntegratorState
+{
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+    TVStack acc;            // acceleration at the current positions, if valid
+    bool acc_valid = false;
+    T time = 0;             // simulated time
+    T last_h = 0;           // size of the last step
+
+    // adaptive step control, set by the owner before every step
+    T tolerance = T(1e-4);  // per component, absolute and relative to the value
+    T h_min = T(1e-6);
+    T h_max = T(0.05);
+    T h_floor = 0;          // no step below it, a try there is accepted over the tolerance; 0 = h_min only
+    T next_h = 0;           // proposal for the next step, 0 = start from the given h
+    long long accepted = 0;
+    long long rejected = 0;
+    long long forced = 0;   // accepted over the tolerance at h_floor or h_min
+
+    // multirate
+    int respa_steps = 4;    // fast steps per slow force evaluation
+    int respa_phase = 0;    // fast steps done in the current slow step
+    TVStack slow_acc;       // slow forces at the start of the current slow step
+    bool slow_valid = false;
+
+    // drop cached forces, e.g. after the params or the method changed; a slow step cut short
+    // starts over, its closing kick would pair with the opening kick of other forces
+    void invalidate()
+    {
+        acc_valid = false;
+        slow_valid = false;
+        respa_phase = 0;
+    }
+};
+
+template <class T, int dim>
+class Integrator
+{
+public:
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+    typedef std::function<TVStack(const TVStack& pos, const TVStack& vel, ForceParts parts)> AccFunction;
+
+    virtual ~Integrator() {}
+    virtual const char* name() const = 0;
+    virtual int order() const = 0;
+    // advances pos and vel by h, returns the force evaluations used
+    virtual int step(TVStack& pos, TVStack& vel, T h, const AccFunction& acc, IntegratorState<T, dim>& state) const = 0;
+};
+
+template <class T, int dim>
+class BasicEuler : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "basic euler"; }
+    int order() const override { return 1; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        TVStack a = acc(pos, vel, ALL_FORCES);
+        PROFILE_SCOPE("integrate");
+        pos += h*vel;
+        vel += h*a;
+        state.acc_valid = false;
+        return 1;
+    }
+};
+
+template <class T, int dim>
+class SymplecticEuler : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "symplectic euler"; }
+    int order() const override { return 1; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        {
+            PROFILE_SCOPE("integrate");
+            pos += h*vel;
+        }
+        TVStack a = acc(pos, vel, ALL_FORCES);
+        PROFILE_SCOPE("integrate");
+        vel += h*a;
+        state.acc_valid = false;
+        return 1;
+    }
+};
+
+template <class T, int dim>
+class ExplicitMidpoint : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "explicit midpoint"; }
+    int order() const override { return 2; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        TVStack mid_pos = pos + h/2*vel;
+        TVStack mid_vel = vel + h/2*acc(pos, vel, ALL_FORCES);
+        TVStack mid_acc = acc(mid_pos, mid_vel, ALL_FORCES);
+        PROFILE_SCOPE("integrate");
+        pos += h*mid_vel;
+        vel += h*mid_acc;
+        state.acc_valid = false;
+        return 2;
+    }
+};
+
+template <class T, int dim>
+class VelocityVerlet : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "velocity verlet"; }
+    int order() const override { return 2; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        return advance(pos, vel, h, acc, state, ALL_FORCES);
+    }
+
+    // one step with the force terms of parts only, the multirate integrator substeps with it
+    static int advance(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state, ForceParts parts)
+    {
+        int evals = 0;
+        if(!state.acc_valid || state.acc.cols() != pos.cols())
+        {
+            state.acc = acc(pos, vel, parts); // first step, or the boids changed
+            evals++;
+        }
+        {
+            PROFILE_SCOPE("integrate");
+            pos += h*vel + h*h/2*state.acc;
+        }
+        // damping terms depend on the velocity, evaluate them at the euler predicted velocity
+        TVStack next_acc = acc(pos, vel + h*state.acc, parts);
+        evals++;
+        PROFILE_SCOPE("integrate");
+        vel += h/2*(state.acc + next_acc);
+        state.acc.swap(next_acc);
+        state.acc_valid = true;
+        return evals;
+    }
+};
+
+template <class T, int dim>
+class RungeKutta4 : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "rk4"; }
+    int order() const override { return 4; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        // x' = v, v' = a(x, v)
+        const TVStack& k1x = vel;
+        TVStack k1v = acc(pos, vel, ALL_FORCES);
+        TVStack k2x = vel + h/2*k1v;
+        TVStack k2v = acc(pos + h/2*k1x, k2x, ALL_FORCES);
+        TVStack k3x = vel + h/2*k2v;
+        TVStack k3v = acc(pos + h/2*k2x, k3x, ALL_FORCES);
+        TVStack k4x = vel + h*k3v;
+        TVStack k4v = acc(pos + h*k3x, k4x, ALL_FORCES);
+        PROFILE_SCOPE("integrate");
+        pos += h/6*(k1x + 2*k2x + 2*k3x + k4x);
+        vel += h/6*(k1v + 2*k2v + 2*k3v + k4v);
+        state.acc_valid = false;
+        return 4;
+    }
+};
+
+// Bogacki-Shampine 3(2): the third order solution is advanced, the embedded
+// second order one estimates its error. A try whose error exceeds the
+// tolerance is repeated with a smaller step, after an accepted step the next
+// one grows or shrinks with the error. The last stage is the acceleration at
+// the new state, so it starts the next step (first same as last).
+// Stiff forces, e.g. the cut-off repulsion of a dense flock, keep the error
+// high at any step; without a floor the step then collapses and most tries
+// are rejected. At h_floor a try is taken anyway, like a fixed step would be.
+template <class T, int dim>
+class AdaptiveBogackiShampine : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "adaptive"; }
+    int order() const override { return 3; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        int evals = 0;
+        if(!state.acc_valid || state.acc.cols() != pos.cols())
+        {
+            state.acc = acc(pos, vel, ALL_FORCES);
+            evals++;
+        }
+        if(state.next_h > 0) h = state.next_h;
+        const T floor_h = std::min(std::max(state.h_floor, state.h_min), state.h_max);
+        h = std::min(std::max(h, floor_h), state.h_max);
+        const TVStack& k1x = vel;
+        const TVStack& k1v = state.acc;
+        bool rejected = false;
+        while(true)
+        {
+            TVStack k2x = vel + h/2*k1v;
+            TVStack k2v = acc(pos + h/2*k1x, k2x, ALL_FORCES);
+            TVStack k3x = vel + 3*h/4*k2v;
+            TVStack k3v = acc(pos + 3*h/4*k2x, k3x, ALL_FORCES);
+            TVStack new_pos = pos + h*(T(2)/9*k1x + T(1)/3*k2x + T(4)/9*k3x);
+            TVStack new_vel = vel + h*(T(2)/9*k1v + T(1)/3*k2v + T(4)/9*k3v);
+            TVStack k4v = acc(new_pos, new_vel, ALL_FORCES);
+            evals += 3;
+
+            T error;
+            {
+                PROFILE_SCOPE("integrate");
+                // difference to the second order solution, k4x is new_vel
+                TVStack error_pos = h*(T(-5)/72*k1x + T(1)/12*k2x + T(1)/9*k3x - T(1)/8*new_vel);
+                TVStack error_vel = h*(T(-5)/72*k1v + T(1)/12*k2v + T(1)/9*k3v - T(1)/8*k4v);
+                error = std::max((error_pos.array().abs() / (state.tolerance*(1 + new_pos.array().abs()))).maxCoeff(),
+                                 (error_vel.array().abs() / (state.tolerance*(1 + new_vel.array().abs()))).maxCoeff());
+            }
+            // 0.9 error^(-1/3) is the step that would just meet the tolerance, with a margin
+            using std::pow;
+            T factor = error > 0 ? T(0.9)*pow(error, T(-1)/3) : T(5);
+            if(!(error == error)) factor = T(0.2); // nan, the forces blew up
+            if(error <= 1 || h <= floor_h)
+            {
+                if(!(error <= 1)) state.forced++;
+                pos.swap(new_pos);
+                vel.swap(new_vel);
+                state.acc.swap(k4v);
+                state.acc_valid = true;
+                state.last_h = h;
+                // grow at most 2x, and not at all right after a rejection
+                T growth = rejected ? T(1) : T(2);
+                state.next_h = std::min(std::max(h*std::min(std::max(factor, T(0.2)), growth), floor_h), state.h_max);
+                state.accepted++;
+                return evals;
+            }
+            state.rejected++;
+            rejected = true;
+            h = std::max(h*std::max(factor, T(0.2)), floor_h);
+        }
+    }
+};
+
+// Multiple time stepping (r-RESPA). The expensive wide-radius slow forces
+// change little over a few steps: they kick the velocities by half of
+// respa_steps*h at the start and at the end of a slow step, in between
+// respa_steps velocity verlet steps of size h only evaluate the fast forces.
+// One call is one fast step, so the simulated time per call stays h.
+// The slow forces at the end of a slow step start the next one.
+template <class T, int dim>
+class MultirateRespa : public Integrator<T, dim>
+{
+public:
+    typedef typename Integrator<T, dim>::TVStack TVStack;
+    const char* name() const override { return "multirate"; }
+    int order() const override { return 2; }
+    int step(TVStack& pos, TVStack& vel, T h, const typename Integrator<T, dim>::AccFunction& acc, IntegratorState<T, dim>& state) const override
+    {
+        int evals = 0;
+        const T slow_h = std::max(state.respa_steps, 1)*h;
+        if(state.respa_phase == 0)
+        {
+            if(!state.slow_valid || state.slow_acc.cols() != pos.cols())
+            {
+                state.slow_acc = acc(pos, vel, SLOW_FORCES);
+                evals++;
+            }
+            PROFILE_SCOPE("integrate");
+            vel += slow_h/2*state.slow_acc;
+        }
+        evals += VelocityVerlet<T, dim>::advance(pos, vel, h, acc, state, FAST_FORCES);
+        if(++state.respa_phase >= state.respa_steps)
+        {
+            state.slow_acc = acc(pos, vel, SLOW_FORCES);
+            evals++;
+            state.slow_valid = true;
+            state.respa_phase = 0;
+            PROFILE_SCOPE("integrate");
+            vel += slow_h/2*state.slow_acc;
+        }
+        return evals;
+    }
+};
+
+// shared instance of the integrator of updateMode
+template <class T, int dim>
+const Integrator<T, dim>& getIntegrator(int updateMode)
+{
+    static const BasicEuler<T, dim> basic;
+    static const SymplecticEuler<T, dim> symplectic;
+    static const ExplicitMidpoint<T, dim> midpoint;
+    static const VelocityVerlet<T, dim> verlet;
+    static const RungeKutta4<T, dim> rk4;
+    static const AdaptiveBogackiShampine<T, dim> adaptive;
+    static const MultirateRespa<T, dim> multirate;
+    switch(updateMode)
+    {
+        case BASIC_EULER: return basic;
+        case SYMPLECTIC_EULER: return symplectic;
+        case EXPLICIT_MIDPOINT: return midpoint;
+        case VELOCITY_VERLET: return verlet;
+        case RK4: return rk4;
+        case ADAPTIVE: return adaptive;
+        case MULTIRATE: return multirate;
+        default: return midpoint; // any other mode was midpoint before
+    }
+}
+#endif
@@ -0,0 +1,210 @@
+#ifndef OBSTACLE_FIELD_H
+#define OBSTACLE_FIELD_H
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <Eigen/Core>
+
+// Obstacle sets baked into a sampled signed distance field. The field covers
+// the obstacles plus band on a grid of cell x cell squares and stores at every
+// node the signed distance to the nearest obstacle, clamped to band, and its
+// gradient (central differences). A lookup is one bilinear interpolation,
+// independent of the number of obstacles.
+// Moving an obstacle only recomputes the nodes within band of its old and new
+// place, stamping the obstacles that reach them; the field grows (one full
+// rebuild) when an obstacle leaves it.
+// The field lives in the xy-plane, in 3d an obstacle is a column along z.
+
+template <class T>
+struct Obstacle
+{
+    typedef Eigen::Matrix<T, 2, 1> V2;
+
+    V2 center = V2::Zero();
+    T radius = 0;              // circle, when there are no vertices
+    std::vector<V2> vertices;  // polygon, relative to center, in either winding
+
+    // negative inside
+    T signedDistance(const V2& p) const
+    {
+        if(vertices.size() < 3) return (p-center).norm() - radius;
+        const V2 q = p-center;
+        T d2 = (q-vertices[0]).squaredNorm();
+        bool inside = false;
+        for(size_t k=0, l=vertices.size()-1;k<vertices.size();l=k++)
+        {
+            const V2& a = vertices[l];
+            const V2& b = vertices[k];
+            const V2 e = b-a;
+            const T t = std::min(std::max((q-a).dot(e)/e.squaredNorm(), T(0)), T(1));
+            d2 = std::min(d2, (q-a-t*e).squaredNorm());
+            // crossing test of a ray along +x
+            if((a[1] > q[1]) != (b[1] > q[1]) && q[0] < a[0] + (q[1]-a[1])*e[0]/e[1]) inside = !inside;
+        }
+        using std::sqrt;
+        return inside ? -sqrt(d2) : sqrt(d2);
+    }
+
+    void bounds(V2& lo, V2& hi) const
+    {
+        if(vertices.size() < 3)
+        {
+            lo = center.array() - radius;
+            hi = center.array() + radius;
+            return;
+        }
+        lo = hi = vertices[0];
+        for(const V2& v : vertices)
+        {
+            lo = lo.cwiseMin(v);
+            hi = hi.cwiseMax(v);
+        }
+        lo += center;
+        hi += center;
+    }
+};
+
+template <class T>
+class ObstacleField
+{
+public:
+    typedef Eigen::Matrix<T, 2, 1> V2;
+
+    void build(const std::vector<Obstacle<T>>& obstacles, T cell, T band)
+    {
+        this->obstacles = obstacles;
+        this->cell = cell;
+        this->band = band;
+        rebuild();
+    }
+
+    // distance to the nearest obstacle (band when farther) and its gradient at p, false outside the field
+    bool sample(const V2& p, T& distance, V2& gradient) const
+    {
+        const T fx = (p[0]-origin[0])/cell, fy = (p[1]-origin[1])/cell;
+        if(!(fx >= 0 && fy >= 0 && fx < nx-1 && fy < ny-1)) return false;
+        const int x = int(fx), y = int(fy);
+        const T u = fx-x, v = fy-y;
+        const int k = y*nx + x;
+        const T w00 = (1-u)*(1-v), w10 = u*(1-v), w01 = (1-u)*v, w11 = u*v;
+        distance = w00*dist[k] + w10*dist[k+1] + w01*dist[k+nx] + w11*dist[k+nx+1];
+        gradient[0] = w00*grad_x[k] + w10*grad_x[k+1] + w01*grad_x[k+nx] + w11*grad_x[k+nx+1];
+        gradient[1] = w00*grad_y[k] + w10*grad_y[k+1] + w01*grad_y[k+nx] + w11*grad_y[k+nx+1];
+        return true;
+    }
+
+    // moves obstacle k, recomputing only the nodes it reaches before and after
+    // returns false when the field had to grow, then every node changed
+    bool move(int k, const V2& center)
+    {
+        V2 old_lo, old_hi;
+        obstacles[k].bounds(old_lo, old_hi);
+        obstacles[k].center = center;
+        V2 lo, hi;
+        obstacles[k].bounds(lo, hi);
+        if((lo.array()-band < origin.array()).any() || (hi.array()+band > extent().array()).any())
+        {
+            rebuild();
+            return false;
+        }
+        update(old_lo.cwiseMin(lo), old_hi.cwiseMax(hi));
+        return true;
+    }
+
+    const std::vector<Obstacle<T>>& getObstacles() const { return obstacles; }
+    bool empty() const { return obstacles.empty(); }
+    int nodeCount() const { return nx*ny; }
+    long long updated_nodes = 0; // nodes recomputed by build() and move(), summed
+
+private:
+    V2 extent() const { return origin + cell*V2(T(nx-1), T(ny-1)); }
+
+    void rebuild()
+    {
+        nx = ny = 0;
+        dist.clear();
+        grad_x.clear();
+        grad_y.clear();
+        if(obstacles.empty()) return;
+        V2 lo, hi;
+        obstacles[0].bounds(lo, hi);
+        for(const Obstacle<T>& obstacle : obstacles)
+        {
+            V2 a, b;
+            obstacle.bounds(a, b);
+            lo = lo.cwiseMin(a);
+            hi = hi.cwiseMax(b);
+        }
+        // one band plus two cells around the obstacles, so the gradient at band is still sampled
+        origin = lo.array() - band - 2*cell;
+        V2 size = hi - lo;
+        using std::ceil;
+        nx = int(ceil((size[0] + 2*band)/cell)) + 5;
+        ny = int(ceil((size[1] + 2*band)/cell)) + 5;
+        dist.assign(size_t(nx)*ny, band);
+        grad_x.assign(size_t(nx)*ny, 0);
+        grad_y.assign(size_t(nx)*ny, 0);
+        update(lo, hi);
+    }
+
+    // recomputes the nodes within band of the box [lo, hi]
+    void update(const V2& lo, const V2& hi)
+    {
+        int x0, y0, x1, y1;
+        nodeRange(lo.array()-band, hi.array()+band, x0, y0, x1, y1);
+        for(int y=y0;y<=y1;y++)
+            for(int x=x0;x<=x1;x++) dist[y*nx + x] = band;
+        for(const Obstacle<T>& obstacle : obstacles)
+        {
+            V2 a, b;
+            obstacle.bounds(a, b);
+            int ox0, oy0, ox1, oy1;
+            nodeRange(a.array()-band, b.array()+band, ox0, oy0, ox1, oy1);
+            ox0 = std::max(ox0, x0); oy0 = std::max(oy0, y0);
+            ox1 = std::min(ox1, x1); oy1 = std::min(oy1, y1);
+            for(int y=oy0;y<=oy1;y++)
+            {
+                for(int x=ox0;x<=ox1;x++)
+                {
+                    const V2 p = origin + cell*V2(T(x), T(y));
+                    T& d = dist[y*nx + x];
+                    d = std::min(d, obstacle.signedDistance(p));
+                }
+            }
+        }
+        updated_nodes += (long long)(x1-x0+1)*(y1-y0+1);
+        // the gradients of the nodes next to the recomputed ones changed too
+        x0 = std::max(x0-1, 0); y0 = std::max(y0-1, 0);
+        x1 = std::min(x1+1, nx-1); y1 = std::min(y1+1, ny-1);
+        for(int y=y0;y<=y1;y++)
+        {
+            for(int x=x0;x<=x1;x++)
+            {
+                const int k = y*nx + x;
+                const int l = x > 0 ? k-1 : k, r = x < nx-1 ? k+1 : k;
+                const int d = y > 0 ? k-nx : k, u = y < ny-1 ? k+nx : k;
+                grad_x[k] = (dist[r]-dist[l])/(cell*(r-l));
+                grad_y[k] = (dist[u]-dist[d])/(cell*T((u-d)/nx));
+            }
+        }
+    }
+
+    // nodes of the box [lo, hi], clamped to the field
+    void nodeRange(const V2& lo, const V2& hi, int& x0, int& y0, int& x1, int& y1) const
+    {
+        using std::floor; using std::ceil;
+        x0 = std::max(int(floor((lo[0]-origin[0])/cell)), 0);
+        y0 = std::max(int(floor((lo[1]-origin[1])/cell)), 0);
+        x1 = std::min(int(ceil((hi[0]-origin[0])/cell)), nx-1);
+        y1 = std::min(int(ceil((hi[1]-origin[1])/cell)), ny-1);
+    }
+
+    std::vector<Obstacle<T>> obstacles;
+    T cell = 0.02;
+    T band = 0.3;
+    V2 origin = V2::Zero();
+    int nx = 0, ny = 0;
+    std::vector<T> dist;           // row major, node (x, y) at origin + cell*(x, y)
+    std::vector<T> grad_x, grad_y;
+};
+#endif
@@ -0,0 +1,52 @@
+#ifndef PERIODIC_H
+#define PERIODIC_H
+#include <cmath>
+#include <Eigen/Core>
+
+// Periodic (toroidal) domain: the box [-period/2, period/2) along every axis,
+// a boid leaving it on one side comes back on the other. Pair distances use
+// the minimum image, the nearest of the periodic copies of the other boid,
+// so pairs across the seam interact like any other pair.
+
+// coordinate moved into [-period/2, period/2)
+template <class T>
+T wrapCoordinate(T x, T period)
+{
+    using std::floor;
+    return x - period*floor(x/period + T(0.5));
+}
+
+// coordinate difference of the nearest copies, in [-period/2, period/2]
+template <class T>
+T minimumImage(T dx, T period)
+{
+    using std::round;
+    return dx - period*round(dx/period);
+}
+
+// box of the force loops, a template parameter of them so OpenBox costs nothing
+template <class T, int dim>
+struct PeriodicBox
+{
+    typedef Eigen::Matrix<T, dim, 1> TV;
+
+    T period = 0;
+
+    // the periodic copy of q nearest to p
+    TV image(const TV& p, const TV& q) const
+    {
+        TV d = q-p;
+        for(int k=0;k<dim;k++) d[k] = minimumImage(d[k], period);
+        return p+d;
+    }
+};
+
+// no box, every boid has one copy
+template <class T, int dim>
+struct OpenBox
+{
+    typedef Eigen::Matrix<T, dim, 1> TV;
+
+    TV image(const TV&, const TV& q) const { return q; }
+};
+#endif
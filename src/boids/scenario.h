@@ -0,0 +1,220 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "boids.h"
+
+// Scenario files: a json object with the boid number, the behavior and any
+// subset of BoidsParams. Missing keys keep the defaults from boids.h, unknown
+// ones throw (a misspelled key would run the default silently). "dim"
+// (2 or 3, default 2) selects the dimension, vectors then have dim entries,
+// "precision" ("float" or "double", default "float") the scalar of the runner
+// (the app always draws in float), e.g.
+// {
+//     "boid_number": 40,
+//     "method": "SEPARATION",
+//     "steps": 20000,
+//     "params": { "h": 0.0005, "rk": 500, "obs_pos": [0, 0] }
+// }
+
+template <class T, int dim>
+struct Scenario
+{
+    int boid_number = 40;               // should be even number for CA_BEHAVE
+    MethodTypes method = FREEFALL;
+    int steps = 10000;                  // only used by the headless runner
+    unsigned int seed = 1;              // seed of the boids' generator, same seed -> same spawn
+    BoidsParams<T, dim> params;
+};
+
+inline const char* methodName(MethodTypes type)
+{
+    static const char* names[] = {"FREEFALL", "CIRCULAR_MOTION", "COHESION", "ALIGNMENT",
+                                  "SEPARATION", "COLLISION_AVOID", "LEADER", "CA_BEHAVE"};
+    return names[type];
+}
+
+// accepts both the enum name ("CA_BEHAVE") and its integer value (7)
+inline MethodTypes parseMethod(const nlohmann::json& j)
+{
+    if(j.is_number_integer())
+    {
+        int type = j.get<int>();
+        if(type < FREEFALL || type > CA_BEHAVE) throw std::runtime_error("unknown method " + j.dump());
+        return MethodTypes(type);
+    }
+    std::string name = j.get<std::string>();
+    for(int type = FREEFALL; type <= CA_BEHAVE; type++)
+    {
+        if(name == methodName(MethodTypes(type))) return MethodTypes(type);
+    }
+    throw std::runtime_error("unknown method " + name);
+}
+
+// throws on the first key of the object j that is not in known, where names the object
+inline void checkKeys(const nlohmann::json& j, const std::vector<std::string>& known, const std::string& where)
+{
+    if(!j.is_object()) throw std::runtime_error(where + " should be a json object");
+    for(auto it = j.begin(); it != j.end(); ++it)
+    {
+        bool found = false;
+        for(const std::string& key : known) found = found || key == it.key();
+        if(!found) throw std::runtime_error("unknown key \"" + it.key() + "\" in " + where);
+    }
+}
+
+template <class T, int dim>
+void readVector(const nlohmann::json& j, const char* key, Vector<T, dim>& v)
+{
+    if(!j.contains(key)) return;
+    const nlohmann::json& arr = j.at(key);
+    if(!arr.is_array() || int(arr.size()) != dim)
+        throw std::runtime_error(std::string(key) + " should be an array of " + std::to_string(dim) + " numbers");
+    for(int d=0;d<dim;d++) v[d] = arr[d].get<T>();
+}
+
+// {"center": [x, y], "radius": r} or {"center": [x, y], "polygon": [[x, y], ...]}, vertices relative to center
+template <class T>
+void from_json(const nlohmann::json& j, Obstacle<T>& obstacle)
+{
+    checkKeys(j, {"center", "radius", "polygon"}, "an obstacle");
+    readVector(j, "center", obstacle.center);
+    obstacle.radius = j.value("radius", obstacle.radius);
+    obstacle.vertices.clear();
+    if(!j.contains("polygon")) return;
+    for(const nlohmann::json& vertex : j.at("polygon"))
+    {
+        if(!vertex.is_array() || vertex.size() != 2) throw std::runtime_error("polygon vertices should be arrays of 2 numbers");
+        obstacle.vertices.emplace_back(vertex[0].get<T>(), vertex[1].get<T>());
+    }
+    if(obstacle.vertices.size() < 3) throw std::runtime_error("a polygon needs at least 3 vertices");
+}
+
+template <class T, int dim>
+void from_json(const nlohmann::json& j, BoidsParams<T, dim>& p)
+{
+    std::vector<std::string> known = {"obs_pos", "obstacles", "fixed_goal_pos"}; // the keys READ_PARAM does not read
+#define READ_PARAM(name) p.name = j.value(#name, p.name); known.push_back(#name)
+    READ_PARAM(h);
+    READ_PARAM(updateMode);
+    READ_PARAM(tolerance);
+    READ_PARAM(h_min);
+    READ_PARAM(h_max);
+    READ_PARAM(adaptive_floor);
+    READ_PARAM(respa_steps);
+    READ_PARAM(implicit_repulsion);
+    READ_PARAM(cg_iterations);
+    READ_PARAM(cg_tolerance);
+    READ_PARAM(sleeping);
+    READ_PARAM(sleep_velocity);
+    READ_PARAM(sleep_steps);
+    READ_PARAM(sleep_distance);
+    READ_PARAM(sleep_acc);
+    READ_PARAM(wake_radius);
+    READ_PARAM(neighbor_grid);
+    READ_PARAM(compact_storage);
+    READ_PARAM(wide_sums);
+    READ_PARAM(theta);
+    READ_PARAM(sum_cells);
+    READ_PARAM(exact_boundary);
+    READ_PARAM(periodic);
+    READ_PARAM(period);
+
+    READ_PARAM(cohesion_radius);
+    READ_PARAM(repel_radius);
+    READ_PARAM(ck);
+    READ_PARAM(ak);
+    READ_PARAM(rk);
+
+    READ_PARAM(obs_radius);
+    READ_PARAM(eyesight_range);
+    READ_PARAM(obs_effect_band);
+    READ_PARAM(ok);
+    READ_PARAM(obs_repel_power);
+    readVector(j, "obs_pos", p.obs_pos);
+    if(j.contains("obstacles"))
+    {
+        p.obstacles.clear();
+        for(const nlohmann::json& obstacle : j.at("obstacles")) p.obstacles.push_back(obstacle.get<Obstacle<T>>());
+    }
+    READ_PARAM(field_cell);
+
+    readVector(j, "fixed_goal_pos", p.fixed_goal_pos);
+    READ_PARAM(max_drag);
+    READ_PARAM(gpk);
+    READ_PARAM(gdk);
+    READ_PARAM(leaders);
+    READ_PARAM(leader_spacing);
+    READ_PARAM(regroup_steps);
+    READ_PARAM(flow_field);
+    READ_PARAM(flow_cell);
+    READ_PARAM(flow_extent);
+    READ_PARAM(flow_clearance);
+
+    READ_PARAM(breed_gap);
+    READ_PARAM(population_cap);
+    READ_PARAM(bound_edge);
+    READ_PARAM(safe_edge);
+    READ_PARAM(bound_repel_acc);
+    READ_PARAM(breed_range);
+    READ_PARAM(death_range);
+    READ_PARAM(enemy_kill);
+    READ_PARAM(repel_death_ratio);
+    READ_PARAM(repel_num);
+    READ_PARAM(strategy);
+    READ_PARAM(verbose);
+#undef READ_PARAM
+    checkKeys(j, known, "params");
+}
+
+template <class T, int dim>
+void from_json(const nlohmann::json& j, Scenario<T, dim>& s)
+{
+    checkKeys(j, {"boid_number", "method", "steps", "seed", "params", "dim", "precision"}, "the scenario");
+    if(j.contains("dim") && j.at("dim").get<int>() != dim)
+        throw std::runtime_error("scenario is " + j.at("dim").dump() + "d, expected " + std::to_string(dim) + "d");
+    s.boid_number = j.value("boid_number", s.boid_number);
+    if(j.contains("method")) s.method = parseMethod(j.at("method"));
+    s.steps = j.value("steps", s.steps);
+    s.seed = j.value("seed", s.seed);
+    if(j.contains("params")) from_json(j.at("params"), s.params);
+}
+
+inline nlohmann::json readScenarioJson(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file.is_open()) throw std::runtime_error("Failed to open scenario file " + path);
+    nlohmann::json j;
+    file >> j;
+    if(j.contains("grid")) throw std::runtime_error(path + " is a sweep grid, pass it with --sweep");
+    return j;
+}
+
+// dimension of a scenario file, to pick the Boids<T, dim> that loads it
+inline int scenarioDim(const std::string& path)
+{
+    int dim = readScenarioJson(path).value("dim", 2);
+    if(dim != 2 && dim != 3) throw std::runtime_error("dim should be 2 or 3, not " + std::to_string(dim));
+    return dim;
+}
+
+// scalar of a scenario file, "float" or "double", to pick the Boids<T, dim> that loads it
+inline std::string scenarioPrecision(const std::string& path)
+{
+    std::string precision = readScenarioJson(path).value("precision", std::string("float"));
+    if(precision != "float" && precision != "double") throw std::runtime_error("precision should be float or double, not " + precision);
+    return precision;
+}
+
+template <class T, int dim>
+Scenario<T, dim> loadScenario(const std::string& path)
+{
+    nlohmann::json j = readScenarioJson(path);
+    Scenario<T, dim> s;
+    from_json(j, s);
+    return s;
+}
+#endif
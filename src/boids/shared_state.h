@@ -0,0 +1,299 @@
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <Eigen/Core>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Live boid states for other processes on the same host, in a POSIX shared
+// memory segment (/dev/shm/<name>): a header and two buffers of positions and
+// velocities, column major as in TVStack. The simulation fills the buffer the
+// readers are not looking at, then points the header to it. Only that switch
+// runs under the seqlock (sequence odd while it changes), so a reader retries
+// only when a frame lands while it reads, and never blocks the writer.
+// Readers map the segment read-only and read the arrays in place: no copy and
+// no system call per frame. A reader that is overtaken by two frames sees the
+// sequence move and reads again.
+
+struct SharedStateHeader
+{
+    static constexpr uint32_t MAGIC = 0x44494f42;  // "BOID"
+    static constexpr uint32_t VERSION = 2;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t scalar_bytes;               // 4 float, 8 double
+    uint32_t capacity;                   // boids per buffer
+    std::atomic<uint32_t> sequence;      // odd while the fields below change
+    uint32_t front;                      // buffer of the latest frame, 0 or 1
+    uint32_t count;                      // boids in it, at most capacity
+    uint32_t team_a;                     // CA_BEHAVE: the first team_a boids are team A, 0 otherwise
+    uint32_t total;                      // boids in the simulation, above count when the frame is cut at capacity
+    uint64_t frame;                      // frames published, 0 before the first
+    uint64_t step;                       // simulation step of the latest frame
+    double time;                         // simulated time of the latest frame
+};
+static_assert(sizeof(SharedStateHeader) <= 64, "the buffers start at byte 64");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the sequence is shared between processes");
+
+// dim and scalar bytes of the segment /name, to pick the reader's Boids<T, dim>; throws like open()
+inline void sharedStateFormat(const std::string& name, int& dim, int& scalar_bytes)
+{
+#ifdef __linux__
+    const std::string path = "/" + name;
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if(fd < 0) throw std::runtime_error("Failed to open shared memory " + path + ": " + std::strerror(errno));
+    struct stat st;
+    void* memory = fstat(fd, &st) == 0 && size_t(st.st_size) >= 64 ? mmap(nullptr, 64, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if(memory == MAP_FAILED) throw std::runtime_error("shared memory " + path + " is not ready");
+    const SharedStateHeader& h = *static_cast<const SharedStateHeader*>(memory);
+    const bool valid = h.magic == SharedStateHeader::MAGIC;
+    dim = int(h.dim);
+    scalar_bytes = int(h.scalar_bytes);
+    munmap(memory, 64);
+    if(!valid) throw std::runtime_error("shared memory " + path + " is not a boids state segment");
+#else
+    (void)dim; (void)scalar_bytes;
+    throw std::runtime_error("shared memory publication needs Linux, " + name);
+#endif
+}
+
+// frame fields a reader gets with the arrays
+struct SharedFrame
+{
+    uint64_t frame;
+    uint64_t step;
+    double time;
+    int team_a;
+    int total;      // boids in the simulation, more than the arrays hold when the frame was cut
+};
+
+template <class T, int dim>
+class SharedStateBase
+{
+public:
+    SharedStateBase() = default;
+    SharedStateBase(const SharedStateBase&) = delete;
+    SharedStateBase& operator=(const SharedStateBase&) = delete;
+    ~SharedStateBase() {unmap();}
+
+    bool isOpen() const { return header != nullptr; }
+    int capacity() const { return header ? int(header->capacity) : 0; }
+    const std::string& name() const { return segment_name; }
+
+    static size_t segmentBytes(int capacity) { return 64 + 2*bufferBytes(capacity); }
+
+protected:
+    static size_t bufferBytes(int capacity) { return 2*size_t(dim)*capacity*sizeof(T); }
+
+    // buffer b: positions, then velocities
+    T* buffer(int b) const
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(header) + 64 + b*bufferBytes(header->capacity));
+    }
+
+    static std::runtime_error error(const std::string& what, const std::string& name)
+    {
+        return std::runtime_error(what + " shared memory " + name + ": " + std::strerror(errno));
+    }
+
+    void unmap()
+    {
+#ifdef __linux__
+        if(header) munmap(header, bytes);
+#endif
+        header = nullptr;
+        bytes = 0;
+    }
+
+    SharedStateHeader* header = nullptr;
+    size_t bytes = 0;
+    std::string segment_name;
+};
+
+// the simulation side, one per segment
+template <class T, int dim>
+class SharedStatePublisher : public SharedStateBase<T, dim>
+{
+public:
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+
+    ~SharedStatePublisher() {close();}
+
+    // creates the segment /name with room for capacity boids; an old one of that name is
+    // unlinked first, its readers keep it until they unmap
+    void open(const std::string& name, int capacity)
+    {
+        close();
+#ifdef __linux__
+        const std::string path = "/" + name;
+        shm_unlink(path.c_str());
+        int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(fd < 0) throw this->error("Failed to create", path);
+        this->bytes = this->segmentBytes(capacity);
+        void* memory = ftruncate(fd, off_t(this->bytes)) == 0 ? mmap(nullptr, this->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd); // the mapping keeps the segment
+        if(memory == MAP_FAILED)
+        {
+            std::runtime_error e = this->error("Failed to map", path);
+            shm_unlink(path.c_str());
+            throw e;
+        }
+        this->header = new(memory) SharedStateHeader();
+        this->header->dim = dim;
+        this->header->scalar_bytes = sizeof(T);
+        this->header->capacity = uint32_t(capacity);
+        this->header->sequence.store(0, std::memory_order_relaxed);
+        this->header->version = SharedStateHeader::VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        this->header->magic = SharedStateHeader::MAGIC; // last, readers check it
+        this->segment_name = path;
+#else
+        (void)capacity;
+        throw std::runtime_error("shared memory publication needs Linux, " + name);
+#endif
+    }
+
+    // removes the name, readers that mapped the segment keep reading the last frame
+    void close()
+    {
+#ifdef __linux__
+        if(this->header) shm_unlink(this->segment_name.c_str());
+#endif
+        this->unmap();
+    }
+
+    // the boids past capacity are left out, then it returns false; the header keeps their total
+    bool publish(const TVStack& pos, const TVStack& vel, uint64_t step, double time, int team_a = 0)
+    {
+        SharedStateHeader& h = *this->header;
+        const uint32_t back = 1 - h.front;
+        const int count = std::min(int(pos.cols()), int(h.capacity));
+        // a reader that sees any of these writes also sees the sequence of the last switch
+        std::atomic_thread_fence(std::memory_order_release);
+        T* data = this->buffer(back);
+        std::memcpy(data, pos.data(), size_t(dim)*count*sizeof(T));
+        std::memcpy(data + size_t(dim)*h.capacity, vel.data(), size_t(dim)*count*sizeof(T));
+
+        const uint32_t sequence = h.sequence.load(std::memory_order_relaxed);
+        h.sequence.store(sequence+1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        h.front = back;
+        h.count = uint32_t(count);
+        h.team_a = uint32_t(std::min(team_a, count));
+        h.total = uint32_t(pos.cols());
+        h.frame++;
+        h.step = step;
+        h.time = time;
+        h.sequence.store(sequence+2, std::memory_order_release);
+        return count == int(pos.cols());
+    }
+};
+
+// any number of them, in any process
+template <class T, int dim>
+class SharedStateReader : public SharedStateBase<T, dim>
+{
+public:
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+    typedef Eigen::Map<const TVStack> StackMap;
+
+    // maps the segment /name read-only, throws when it is missing or holds another Boids<T, dim>
+    void open(const std::string& name)
+    {
+        this->unmap();
+#ifdef __linux__
+        const std::string path = "/" + name;
+        int fd = shm_open(path.c_str(), O_RDONLY, 0);
+        if(fd < 0) throw this->error("Failed to open", path);
+        struct stat st;
+        if(fstat(fd, &st) != 0 || size_t(st.st_size) < 64)
+        {
+            ::close(fd);
+            throw std::runtime_error("shared memory " + path + " is not ready");
+        }
+        void* memory = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(memory == MAP_FAILED) throw this->error("Failed to map", path);
+        this->header = static_cast<SharedStateHeader*>(memory);
+        this->bytes = size_t(st.st_size);
+        this->segment_name = path;
+        const SharedStateHeader& h = *this->header;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::string mismatch;
+        if(h.magic != SharedStateHeader::MAGIC || h.version != SharedStateHeader::VERSION) mismatch = "is not a boids state segment";
+        else if(h.dim != dim || h.scalar_bytes != sizeof(T))
+            mismatch = "holds " + std::to_string(h.dim) + "d states of " + std::to_string(h.scalar_bytes) + "-byte scalars";
+        else if(this->bytes < this->segmentBytes(int(h.capacity))) mismatch = "is truncated";
+        if(!mismatch.empty())
+        {
+            this->unmap();
+            throw std::runtime_error("shared memory " + path + " " + mismatch);
+        }
+#else
+        throw std::runtime_error("shared memory publication needs Linux, " + name);
+#endif
+    }
+
+    // frames published so far, one load, to poll for a new one
+    uint64_t latestFrame() const
+    {
+        const SharedStateHeader& h = *this->header;
+        for(;;)
+        {
+            const uint32_t sequence = h.sequence.load(std::memory_order_acquire);
+            const uint64_t frame = h.frame;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(!(sequence & 1) && h.sequence.load(std::memory_order_relaxed) == sequence) return frame;
+        }
+    }
+
+    // calls fn(pos, vel, frame) on the latest frame in place, false before the first frame.
+    // fn runs again when the writer overtook it, so it should only read (or copy out);
+    // retries counts those runs
+    template <class Fn>
+    bool read(Fn fn)
+    {
+        const SharedStateHeader& h = *this->header;
+        for(;;)
+        {
+            const uint32_t sequence = h.sequence.load(std::memory_order_acquire);
+            if(sequence & 1) continue; // the header is switching, a few stores
+            const uint64_t frame = h.frame;
+            if(frame == 0) return false;
+            const int count = int(std::min(h.count, h.capacity));
+            const T* data = this->buffer(int(h.front & 1));
+            fn(StackMap(data, dim, count), StackMap(data + size_t(dim)*h.capacity, dim, count),
+               SharedFrame{frame, h.step, h.time, int(h.team_a), int(h.total)});
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(h.sequence.load(std::memory_order_relaxed) == sequence) return true;
+            retries++;
+        }
+    }
+
+    // copies of the latest frame
+    bool copy(TVStack& pos, TVStack& vel, SharedFrame& frame)
+    {
+        return read([&](const StackMap& p, const StackMap& v, const SharedFrame& f) {
+            pos = p;
+            vel = v;
+            frame = f;
+        });
+    }
+
+    uint64_t retries = 0;
+};
+#endif
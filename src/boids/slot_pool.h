@@ -0,0 +1,58 @@
+#ifndef SLOT_POOL_H
+#define SLOT_POOL_H
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Slots of a CA_BEHAVE team under a population cap. The team's matrices keep
+// capacity columns for the whole run: a dying boid frees its slot, a newborn
+// takes the lowest free one, so nothing is resized after the spawn and the
+// memory of a run is fixed when it starts.
+
+class SlotPool
+{
+public:
+    // capacity slots, the first used of them alive
+    void reset(int capacity, int used)
+    {
+        live.assign(capacity, 0);
+        std::fill(live.begin(), live.begin()+used, 1);
+        free_slots.clear();
+        free_slots.reserve(capacity);
+        for(int slot=used;slot<capacity;slot++) free_slots.push_back(slot);
+        std::make_heap(free_slots.begin(), free_slots.end(), std::greater<int>());
+        count = used;
+    }
+
+    // lowest free slot, now alive, -1 when the pool is full
+    int take()
+    {
+        if(free_slots.empty()) return -1;
+        std::pop_heap(free_slots.begin(), free_slots.end(), std::greater<int>());
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        live[slot] = 1;
+        count++;
+        return slot;
+    }
+
+    void release(int slot)
+    {
+        if(!live[slot]) return;
+        live[slot] = 0;
+        free_slots.push_back(slot);
+        std::push_heap(free_slots.begin(), free_slots.end(), std::greater<int>());
+        count--;
+    }
+
+    bool alive(int slot) const { return live[slot]; }
+    int size() const { return count; }                 // live boids
+    int capacity() const { return int(live.size()); }
+    const std::vector<char>& mask() const { return live; }
+
+private:
+    std::vector<char> live;      // per slot
+    std::vector<int> free_slots; // min-heap of the dead slots
+    int count = 0;
+};
+#endif
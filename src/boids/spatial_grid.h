@@ -0,0 +1,422 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <Eigen/Core>
+#include "periodic.h"
+
+// Uniform grid over the bounding box of the boids, in any dimension. build()
+// counting-sorts the boids by cell, so the boids of a cell are contiguous and
+// keep their index order. The sorted coordinates are stored structure of
+// arrays (one contiguous column per axis), so the distance prefilter of a
+// query runs over plain arrays and vectorizes for dim = 2 and dim = 3 alike.
+// With cell_size >= radius, all boids within radius of p lie in the 3^dim
+// cells around the cell of p. A query returns a superset of the boids within
+// radius; callers apply their own exact distance test.
+// pack() adds a 16-bit copy of the sorted positions and velocities, which
+// forEachNearPacked() streams instead of the float ones.
+// accumulate() adds per-cell sums of positions and velocities and counts,
+// prefix-summed along every row of cells (axis 0). cellSums() then adds the
+// cells that lie wholly inside a ball row by row in O(1) per row, only the
+// cells on its boundary need tests per boid, or none when counted by their
+// center of mass.
+// With a period the grid is fixed to the periodic box instead (periodic.h):
+// cells wrap around at its sides, boids are binned and queried at their
+// wrapped coordinates and the distance prefilter takes the minimum image.
+// cellSums() does not wrap.
+
+template <class T, int dim>
+class SpatialGrid
+{
+public:
+    typedef Eigen::Matrix<T, dim, 1> TV;
+    typedef Eigen::Matrix<T, dim, Eigen::Dynamic> TVStack;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, dim> SortedCoords;  // column-major: one array per axis
+
+    // most cells per boid; boids flung far away make the cells bigger instead of the grid huge
+    static constexpr int max_cells_per_boid = 8;
+
+    // period > 0: periodic box [-period/2, period/2)^dim; live: only the boids marked there are
+    // binned (slot pools), the others are never returned and not summed
+    void build(const TVStack& pos, T cell_size, T period = 0, const std::vector<char>* live = nullptr)
+    {
+        const int n = int(pos.cols());
+        count = n;
+        this->period = period;
+        if(n == 0) return;
+        if(period > 0)
+        {
+            buildPeriodic(pos, cell_size, live);
+            return;
+        }
+        origin = pos.rowwise().minCoeff();
+        TV extent = pos.rowwise().maxCoeff() - origin;
+        cell = cell_size;
+        long long cells = 1;
+        if(!extent.allFinite())
+        {
+            // a boid blew up, fall back to one cell
+            for(int d=0;d<dim;d++) resolution[d] = 1;
+        }
+        else
+        {
+            const double max_cells = std::max(64., double(max_cells_per_boid)*n);
+            while(true)
+            {
+                double total = 1;
+                for(int d=0;d<dim;d++) total *= std::floor(double(extent[d])/double(cell)) + 1;
+                if(total <= max_cells) break;
+                cell *= 2;
+            }
+            for(int d=0;d<dim;d++)
+            {
+                resolution[d] = int(extent[d]/cell) + 1;
+                cells *= resolution[d];
+            }
+        }
+
+        sortIntoCells(pos, cells, live);
+    }
+
+    // calls fn(j) for every boid j (original index) within radius of p, possibly a few more
+    // radius <= the cell size of build(); boids come cell by cell, in index order within a cell
+    template <class Fn>
+    void forEachNear(const TV& p, T radius, Fn&& fn) const
+    {
+        scan(p, radius, [&](int begin, int, int d, T) { return sorted.col(d).data() + begin; },
+             [&](int begin, int k) { fn(order[begin+k]); });
+    }
+
+    // 16-bit copy of the sorted boids of the last build(), for pair loops that stream their
+    // neighbors: a coordinate is its offset from the low corner of its cell in 1/65536 cells, a
+    // velocity component a multiple of 1/32767 of the largest one. 4*dim bytes per boid instead
+    // of the 8*dim of float positions and velocities, errors below cell/131072 and vmax/65534.
+    void pack(const TVStack& vel)
+    {
+        packed_pos.resize(count, dim);
+        packed_vel.resize(count, dim);
+        const T vmax = count == 0 ? T(0) : T(vel.cwiseAbs().maxCoeff());
+        vel_step = vmax < std::numeric_limits<T>::max() ? T(vmax/32767) : T(0); // also nan
+        using std::lround;
+        for(int k=0;k<count;k++)
+        {
+            long long c = cell_of[order[k]];
+            for(int d=0;d<dim;d++)
+            {
+                const T corner = origin[d] + T(c%resolution[d])*cell;
+                c /= resolution[d];
+                const double offset = double(sorted(k, d) - corner)/double(cell)*65536 + 0.5;
+                packed_pos(k, d) = uint16_t(!(offset > 0) ? 0. : std::min(offset, 65535.));
+                packed_vel(k, d) = vel_step > 0 ? int16_t(lround(vel(d, order[k])/vel_step)) : int16_t(0);
+            }
+        }
+    }
+
+    // forEachNear() on the copy of pack(): fn(j, q, v) with the decoded position q (wrapped into
+    // the box with a period) and velocity v of boid j
+    template <class Fn>
+    void forEachNearPacked(const TV& p, T radius, Fn&& fn) const
+    {
+        const T step = cell/65536;
+        T decoded[dim][block];
+        scan(p, radius, [&](int begin, int m, int d, T corner) {
+            for(int k=0;k<m;k++) decoded[d][k] = corner + T(packed_pos(begin+k, d))*step;
+            return (const T*)decoded[d];
+        }, [&](int begin, int k) {
+            TV q, v;
+            for(int d=0;d<dim;d++)
+            {
+                q[d] = decoded[d][k];
+                v[d] = T(packed_vel(begin+k, d))*vel_step;
+            }
+            fn(order[begin+k], q, v);
+        });
+    }
+
+    // per-cell sums of the boids of the last build(), pos and vel by original index
+    void accumulate(const TVStack& pos, const TVStack& vel)
+    {
+        const int row_length = resolution[0] + 1;
+        const int rows = count == 0 ? 0 : cellCount()/resolution[0];
+        prefix_count.assign(size_t(rows)*row_length, 0);
+        prefix_pos = TVStack::Zero(dim, rows*row_length);
+        prefix_vel = TVStack::Zero(dim, rows*row_length);
+        for(int k=0;k<count;k++)
+        {
+            const int i = order[k];
+            long long c = cell_of[i];
+            int at = int(c/resolution[0])*row_length + int(c%resolution[0]) + 1;
+            prefix_count[at]++;
+            prefix_pos.col(at) += pos.col(i);
+            prefix_vel.col(at) += vel.col(i);
+        }
+        for(int r=0;r<rows;r++)
+        {
+            for(int k=r*row_length+1;k<(r+1)*row_length;k++)
+            {
+                prefix_count[k] += prefix_count[k-1];
+                prefix_pos.col(k) += prefix_pos.col(k-1);
+                prefix_vel.col(k) += prefix_vel.col(k-1);
+            }
+        }
+    }
+
+    // sums over the boids j != i within radius of boid i, after accumulate()
+    // exact_boundary: test every boid of the boundary cells, else count such a cell whole when its
+    // center of mass is within radius (the cell of boid i is always tested)
+    void cellSums(const TVStack& pos, const TVStack& vel, int i, T radius, bool exact_boundary,
+                  TV& pos_sum, TV& vel_sum, int& neighbors) const
+    {
+        pos_sum.setZero();
+        vel_sum.setZero();
+        neighbors = 0;
+        if(count == 0) return;
+        const TV p = pos.col(i);
+        const T r2 = radius*radius;
+        const int row_length = resolution[0] + 1;
+        const long long own_cell = cell_of[i];
+        // rows of cells along axis 0 that may reach the ball, odometer over axes 1..dim-1
+        int lo[dim], hi[dim], at[dim];
+        for(int d=1;d<dim;d++)
+        {
+            lo[d] = clampCell(d, p[d]-radius);
+            hi[d] = clampCell(d, p[d]+radius);
+            at[d] = lo[d];
+        }
+        auto addRange = [&](int row, int begin, int end) {  // whole cells [begin, end) of a row
+            const int a = row*row_length + begin, b = row*row_length + end;
+            pos_sum += prefix_pos.col(b) - prefix_pos.col(a);
+            vel_sum += prefix_vel.col(b) - prefix_vel.col(a);
+            neighbors += prefix_count[b] - prefix_count[a];
+        };
+        auto testCell = [&](long long c) {
+            for(int k=cell_start[c];k<cell_start[c+1];k++)
+            {
+                const int j = order[k];
+                if(j == i || (pos.col(j)-p).squaredNorm() > r2) continue;
+                pos_sum += pos.col(j);
+                vel_sum += vel.col(j);
+                neighbors++;
+            }
+        };
+        using std::abs; using std::sqrt; using std::floor; using std::ceil;
+        while(true)
+        {
+            // squared distance of p to the nearest and farthest point of the row's cross section
+            T near2 = 0, far2 = 0;
+            int row = 0;
+            for(int d=dim-1;d>=1;d--)
+            {
+                const T c0 = origin[d] + at[d]*cell, c1 = c0 + cell;
+                const T gap = std::max(std::max(c0-p[d], p[d]-c1), T(0));
+                const T reach = std::max(abs(p[d]-c0), abs(p[d]-c1));
+                near2 += gap*gap;
+                far2 += reach*reach;
+                row = row*resolution[d] + at[d];
+            }
+            if(near2 <= r2)
+            {
+                // cells of the row that touch the ball, and the ones inside it
+                const T touch = sqrt(r2-near2);
+                int first = clampCell(0, p[0]-touch), last = clampCell(0, p[0]+touch);
+                int inner_begin = last + 1, inner_end = last + 1;
+                if(far2 <= r2)
+                {
+                    const T inside = sqrt(r2-far2);
+                    inner_begin = std::max(first, int(ceil((p[0]-inside-origin[0])/cell)));
+                    inner_end = std::min(last + 1, int(floor((p[0]+inside-origin[0])/cell)));
+                    if(inner_end <= inner_begin) inner_begin = inner_end = last + 1;
+                }
+                if(inner_end > inner_begin)
+                {
+                    addRange(row, inner_begin, inner_end);
+                    const long long own_x = own_cell - (long long)row*resolution[0];
+                    if(own_x >= inner_begin && own_x < inner_end)
+                    {
+                        // boid i was summed with its cell
+                        pos_sum -= p;
+                        vel_sum -= vel.col(i);
+                        neighbors--;
+                    }
+                }
+                for(int x=first;x<=last;x++)
+                {
+                    if(x == inner_begin) x = inner_end;
+                    if(x > last) break;
+                    const long long c = (long long)row*resolution[0] + x;
+                    if(exact_boundary || c == own_cell)
+                    {
+                        testCell(c);
+                        continue;
+                    }
+                    const int a = row*row_length + x;
+                    const int m = prefix_count[a+1] - prefix_count[a];
+                    if(m == 0) continue;
+                    const TV cell_pos = prefix_pos.col(a+1) - prefix_pos.col(a);
+                    if((cell_pos/T(m)-p).squaredNorm() > r2) continue;
+                    pos_sum += cell_pos;
+                    vel_sum += prefix_vel.col(a+1) - prefix_vel.col(a);
+                    neighbors += m;
+                }
+            }
+            int d = 1;
+            while(d < dim && at[d] == hi[d])
+            {
+                at[d] = lo[d];
+                d++;
+            }
+            if(d == dim) break;
+            at[d]++;
+        }
+    }
+
+    T cellSize() const { return cell; }
+    int cellCount() const { return int(cell_start.size()) - 1; }
+    const std::vector<int>& sortedOrder() const { return order; }  // boid of every sorted slot
+
+private:
+    static constexpr int block = 64;
+
+    // the cell walk of the queries: blocks of at most block sorted slots of the 3^dim cells around p,
+    // coords(begin, m, d, corner) returns the axis d coordinates of slots [begin, begin+m) of a cell
+    // whose low corner is at corner along d, emit(begin, k) gets slot begin+k when it passes the prefilter
+    template <class Coords, class Emit>
+    void scan(const TV& p, T radius, Coords&& coords, Emit&& emit) const
+    {
+        if(count == 0) return;
+        int center[dim], lo[dim], hi[dim], at[dim];
+        for(int d=0;d<dim;d++)
+        {
+            center[d] = clampCell(d, p[d]);
+            lo[d] = std::max(center[d]-1, 0);
+            hi[d] = std::min(center[d]+1, resolution[d]-1);
+            // periodic: the neighbor cells wrap around, with fewer than 3 cells every cell is a neighbor once
+            if(period > 0 && resolution[d] >= 3)
+            {
+                lo[d] = center[d]-1;
+                hi[d] = center[d]+1;
+            }
+            at[d] = lo[d];
+        }
+        // prefilter on the squared distance with a margin, the caller's test decides
+        const T r2 = radius*radius*T(1.0001);
+        const T half = period/2;
+        T d2[block];
+        while(true)
+        {
+            long long c = 0;
+            for(int d=dim-1;d>=0;d--) c = c*resolution[d] + (at[d]+resolution[d])%resolution[d];
+            for(int begin=cell_start[c];begin<cell_start[c+1];begin+=block)
+            {
+                const int m = std::min(block, cell_start[c+1]-begin);
+                for(int k=0;k<m;k++) d2[k] = 0;
+                for(int d=0;d<dim;d++)
+                {
+                    const T* x = coords(begin, m, d, origin[d] + T((at[d]+resolution[d])%resolution[d])*cell);
+                    if(period > 0)
+                    {
+                        // both coordinates are wrapped, so one shift by period gives the minimum image
+                        const T pd = wrapCoordinate(p[d], period);
+                        for(int k=0;k<m;k++)
+                        {
+                            T dx = x[k]-pd;
+                            dx = dx > half ? dx-period : (dx < -half ? dx+period : dx);
+                            d2[k] += dx*dx;
+                        }
+                        continue;
+                    }
+                    const T pd = p[d];
+                    for(int k=0;k<m;k++) d2[k] += (x[k]-pd)*(x[k]-pd);
+                }
+                for(int k=0;k<m;k++)
+                    if(d2[k] <= r2) emit(begin, k);
+            }
+            // next cell of the 3^dim block, odometer style
+            int d = 0;
+            while(d < dim && at[d] == hi[d])
+            {
+                at[d] = lo[d];
+                d++;
+            }
+            if(d == dim) break;
+            at[d]++;
+        }
+    }
+
+    // fixed grid over the periodic box, cells at least cell_size wide
+    void buildPeriodic(const TVStack& pos, T cell_size, const std::vector<char>* live)
+    {
+        const int n = int(pos.cols());
+        origin = TV::Constant(-period/2);
+        int per_axis = std::max(int(period/cell_size), 1);
+        const double max_cells = std::max(64., double(max_cells_per_boid)*n);
+        while(per_axis > 1 && std::pow(double(per_axis), dim) > max_cells) per_axis /= 2;
+        cell = period/per_axis;
+        long long cells = 1;
+        for(int d=0;d<dim;d++)
+        {
+            resolution[d] = per_axis;
+            cells *= per_axis;
+        }
+        TVStack wrapped = pos.unaryExpr([this](T x) { return wrapCoordinate(x, period); });
+        sortIntoCells(wrapped, cells, live);
+    }
+
+    // counting sort of the (live) boids by cell, count becomes the number of sorted boids
+    void sortIntoCells(const TVStack& pos, long long cells, const std::vector<char>* live)
+    {
+        const int n = int(pos.cols());
+        cell_start.assign(cells + 1, 0);
+        cell_of.assign(n, -1);
+        count = 0;
+        for(int i=0;i<n;i++)
+        {
+            if(live && !(*live)[i]) continue;
+            cell_of[i] = cellIndex(pos.col(i));
+            cell_start[cell_of[i] + 1]++;
+            count++;
+        }
+        for(long long c=0;c<cells;c++) cell_start[c+1] += cell_start[c];
+        order.resize(count);
+        std::vector<int> fill(cell_start.begin(), cell_start.end()-1);
+        for(int i=0;i<n;i++)
+            if(cell_of[i] >= 0) order[fill[cell_of[i]]++] = i;
+        sorted.resize(count, dim);
+        for(int k=0;k<count;k++) sorted.row(k) = pos.col(order[k]).transpose();
+    }
+
+    int clampCell(int d, T x) const
+    {
+        using std::floor;
+        if(period > 0) x = wrapCoordinate(x, period);
+        T c = floor((x - origin[d])/cell);
+        if(!(c > 0)) return 0; // also nan
+        if(c >= T(resolution[d]-1)) return resolution[d]-1;
+        return int(c);
+    }
+    long long cellIndex(const TV& p) const
+    {
+        long long c = 0;
+        for(int d=dim-1;d>=0;d--) c = c*resolution[d] + clampCell(d, p[d]);
+        return c;
+    }
+
+    int count = 0;                  // boids in the grid
+    T period = 0;                   // periodic box side, 0 without
+    TV origin = TV::Zero();
+    T cell = 1;
+    int resolution[dim] = {};
+    std::vector<int> cell_start;    // boids of cell c are sorted slots [cell_start[c], cell_start[c+1])
+    std::vector<long long> cell_of; // cell of every boid, by original index
+    std::vector<int> order;         // original index of every sorted slot
+    SortedCoords sorted;            // coordinates in sorted order
+    Eigen::Matrix<uint16_t, Eigen::Dynamic, dim> packed_pos;  // pack(): offsets in their cell, sorted order
+    Eigen::Matrix<int16_t, Eigen::Dynamic, dim> packed_vel;   // and velocities in units of vel_step
+    T vel_step = 0;
+    std::vector<int> prefix_count;  // accumulate(): per row of cells resolution[0]+1 prefix sums
+    TVStack prefix_pos, prefix_vel;
+};
+#endif
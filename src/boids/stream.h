@@ -0,0 +1,413 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Streaming of a running simulation to viewers on the same host, over a Unix
+// domain socket ("unix:/tmp/boids.sock") or loopback TCP ("tcp:7700", bound
+// to 127.0.0.1 only). The server sends position frames, a viewer sends
+// command lines back ("pause", "reinit", "target x y", "method LEADER", see
+// the runner). A frame is a StreamFrameHeader, then every coordinate as 16
+// bits over the bounding box of the frame: 4 bytes per boid in 2d instead of
+// 8, off by at most box/131070. Everything is in host byte order.
+// Sockets never block the simulation: a viewer whose last frame is still
+// queued misses the new one (dropped), the frames it gets are always whole.
+
+struct StreamFrameHeader
+{
+    static constexpr uint32_t MAGIC = 0x52545342;  // "BSTR"
+
+    uint32_t bytes;          // of the message after this field
+    uint32_t magic;
+    uint8_t dim;
+    uint8_t method;          // MethodTypes
+    uint16_t leaders;        // LEADER: the first leaders boids lead
+    uint32_t count;
+    uint32_t team_a;         // CA_BEHAVE: the first team_a boids are team A
+    uint32_t reserved;
+    uint64_t step;
+    float lo[3];             // bounding box of the positions, the quantization grid
+    float hi[3];
+};
+static_assert(sizeof(StreamFrameHeader) == 56, "the coordinates follow the header");
+
+// what a viewer gets with the positions
+struct StreamFrameInfo
+{
+    int method;
+    uint64_t step;
+    int leaders;
+    int team_a;
+};
+
+// scratch of the quantized coordinates, one per thread
+inline std::vector<uint16_t>& encodeBuffer()
+{
+    thread_local std::vector<uint16_t> bits;
+    return bits;
+}
+
+template <class T, int dim>
+void encodeFrame(const Eigen::Matrix<T, dim, Eigen::Dynamic>& pos, int method, uint64_t step, int leaders, int team_a, std::string& message)
+{
+    StreamFrameHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = StreamFrameHeader::MAGIC;
+    header.dim = uint8_t(dim);
+    header.method = uint8_t(method);
+    header.leaders = uint16_t(leaders);
+    header.count = uint32_t(pos.cols());
+    header.team_a = uint32_t(team_a);
+    header.step = step;
+    // bounding box in one pass over the columns, Eigen's row reductions stride through memory
+    const T* in = pos.data();
+    const int n = int(pos.cols());
+    float lo[dim], hi[dim], scale[dim]; // locals, the stores into the message alias everything
+    for(int d=0;d<dim;d++) lo[d] = hi[d] = n > 0 ? float(in[d]) : 0.f;
+    for(int i=0;i<n;i++)
+    {
+        for(int d=0;d<dim;d++)
+        {
+            lo[d] = std::min(lo[d], float(in[i*dim + d]));
+            hi[d] = std::max(hi[d], float(in[i*dim + d]));
+        }
+    }
+    for(int d=0;d<dim;d++)
+    {
+        header.lo[d] = lo[d];
+        header.hi[d] = hi[d];
+        scale[d] = hi[d] > lo[d] ? 65535.f/(hi[d]-lo[d]) : 0.f;
+    }
+    message.resize(sizeof(header) + 2*size_t(dim)*n);
+    header.bytes = uint32_t(message.size() - sizeof(header.bytes));
+    std::memcpy(&message[0], &header, sizeof(header));
+    std::vector<uint16_t>& bits = encodeBuffer();
+    bits.resize(size_t(dim)*n);
+    for(int i=0;i<n;i++)
+        for(int d=0;d<dim;d++)
+            bits[i*dim + d] = uint16_t(std::min(std::max((float(in[i*dim + d]) - lo[d])*scale[d] + 0.5f, 0.f), 65535.f));
+    std::memcpy(&message[sizeof(header)], bits.data(), 2*bits.size());
+}
+
+// false when the message is not a whole frame, throws when it is a frame of another dim
+template <class T, int dim>
+bool decodeFrame(const std::string& message, Eigen::Matrix<T, dim, Eigen::Dynamic>& pos, StreamFrameInfo& info)
+{
+    StreamFrameHeader header;
+    if(message.size() < sizeof(header)) return false;
+    std::memcpy(&header, message.data(), sizeof(header));
+    if(header.magic != StreamFrameHeader::MAGIC) return false;
+    if(header.dim != dim)
+        throw std::runtime_error("the stream sends " + std::to_string(header.dim) + "d frames, this viewer draws " + std::to_string(dim) + "d");
+    if(message.size() != sizeof(header) + 2*size_t(dim)*header.count) return false;
+    info = StreamFrameInfo{header.method, header.step, header.leaders, int(header.team_a)};
+    pos.resize(dim, header.count);
+    const char* in = message.data() + sizeof(header);
+    for(uint32_t i=0;i<header.count;i++)
+    {
+        for(int d=0;d<dim;d++)
+        {
+            uint16_t bits;
+            std::memcpy(&bits, in, 2);
+            in += 2;
+            pos(d,i) = T(header.lo[d] + bits*((header.hi[d]-header.lo[d])/65535.f));
+        }
+    }
+    return true;
+}
+
+// socket of "unix:path" or "tcp:port", listening for the server or connected for a viewer
+inline int openStreamSocket(const std::string& address, bool listening)
+{
+#ifdef __linux__
+    const bool is_unix = address.compare(0, 5, "unix:") == 0;
+    if(!is_unix && address.compare(0, 4, "tcp:") != 0)
+        throw std::runtime_error("stream address should be unix:<path> or tcp:<port>, not " + address);
+    const int fd = socket(is_unix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) throw std::runtime_error("Failed to open a socket for " + address + ": " + std::strerror(errno));
+    sockaddr_un unix_address;
+    sockaddr_in tcp_address;
+    sockaddr* socket_address;
+    socklen_t length;
+    if(is_unix)
+    {
+        const std::string path = address.substr(5);
+        std::memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        if(path.empty() || path.size() >= sizeof(unix_address.sun_path))
+        {
+            ::close(fd);
+            throw std::runtime_error("bad socket path " + path);
+        }
+        std::strcpy(unix_address.sun_path, path.c_str());
+        if(listening) unlink(path.c_str()); // a socket file left by an old server
+        socket_address = reinterpret_cast<sockaddr*>(&unix_address);
+        length = sizeof(unix_address);
+    }
+    else
+    {
+        const int port = atoi(address.c_str() + 4);
+        if(port <= 0 || port > 65535)
+        {
+            ::close(fd);
+            throw std::runtime_error("bad port in " + address);
+        }
+        std::memset(&tcp_address, 0, sizeof(tcp_address));
+        tcp_address.sin_family = AF_INET;
+        tcp_address.sin_port = htons(uint16_t(port));
+        tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        socket_address = reinterpret_cast<sockaddr*>(&tcp_address);
+        length = sizeof(tcp_address);
+    }
+    const bool ok = listening ? bind(fd, socket_address, length) == 0 && ::listen(fd, 8) == 0 : connect(fd, socket_address, length) == 0;
+    if(!ok)
+    {
+        const std::string reason = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error(std::string(listening ? "Failed to listen on " : "Failed to connect to ") + address + ": " + reason);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+#else
+    (void)listening;
+    throw std::runtime_error("streaming needs Linux, " + address);
+#endif
+}
+
+// the simulation side, any number of viewers
+class StreamServer
+{
+public:
+    StreamServer() = default;
+    StreamServer(const StreamServer&) = delete;
+    StreamServer& operator=(const StreamServer&) = delete;
+    ~StreamServer() {close();}
+
+    void listen(const std::string& address)
+    {
+        close();
+        listen_fd = openStreamSocket(address, true);
+        listen_address = address;
+    }
+
+    void close()
+    {
+#ifdef __linux__
+        for(Viewer& viewer : viewers) ::close(viewer.fd);
+        if(listen_fd >= 0)
+        {
+            ::close(listen_fd);
+            if(listen_address.compare(0, 5, "unix:") == 0) unlink(listen_address.c_str() + 5);
+        }
+#endif
+        viewers.clear();
+        listen_fd = -1;
+    }
+
+    // accepts new viewers, appends their whole command lines to commands and
+    // sends what is left of their frames; never waits
+    void poll(std::vector<std::string>& commands)
+    {
+#ifdef __linux__
+        if(listen_fd < 0) return;
+        for(int fd;(fd = accept(listen_fd, nullptr, nullptr)) >= 0;)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on a unix socket
+            viewers.push_back(Viewer{fd, std::string(), 0, std::string()});
+        }
+        for(size_t k=0;k<viewers.size();)
+        {
+            Viewer& viewer = viewers[k];
+            bool alive = flush(viewer);
+            char buffer[4096];
+            while(alive)
+            {
+                const ssize_t got = recv(viewer.fd, buffer, sizeof(buffer), 0);
+                if(got > 0) viewer.in.append(buffer, size_t(got));
+                else if(got == 0) alive = false; // the viewer closed
+                else if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+                else if(errno != EINTR) alive = false;
+                size_t begin = 0;
+                for(size_t end;(end = viewer.in.find('\n', begin)) != std::string::npos;begin = end+1)
+                    commands.push_back(viewer.in.substr(begin, end-begin));
+                viewer.in.erase(0, begin);
+                if(viewer.in.size() > 65536) alive = false; // a line that long is not a command
+            }
+            if(alive) k++;
+            else
+            {
+                ::close(viewer.fd);
+                viewers.erase(viewers.begin()+k);
+            }
+        }
+#else
+        (void)commands;
+#endif
+    }
+
+    // queues the message for every viewer; one whose last message is still queued misses it
+    void broadcast(const std::string& message)
+    {
+        for(Viewer& viewer : viewers)
+        {
+            if(viewer.offset < viewer.out.size())
+            {
+                dropped++;
+                continue;
+            }
+            viewer.out = message;
+            viewer.offset = 0;
+            sent++;
+            flush(viewer); // a dead viewer goes at the next poll()
+        }
+    }
+
+    bool isOpen() const { return listen_fd >= 0; }
+    int viewerCount() const { return int(viewers.size()); }
+    const std::string& address() const { return listen_address; }
+
+    uint64_t sent = 0;       // frames handed to viewers, counted once per viewer
+    uint64_t dropped = 0;    // frames a busy viewer missed
+
+private:
+    struct Viewer
+    {
+        int fd;
+        std::string out;     // the frame being sent, from offset on
+        size_t offset;
+        std::string in;      // the start of a command line
+    };
+
+    // sends as much as the socket takes, false when the viewer is gone
+    bool flush(Viewer& viewer)
+    {
+#ifdef __linux__
+        while(viewer.offset < viewer.out.size())
+        {
+            ssize_t put = ::send(viewer.fd, viewer.out.data() + viewer.offset, viewer.out.size() - viewer.offset, MSG_NOSIGNAL);
+            if(put < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            viewer.offset += size_t(put);
+        }
+#endif
+        return true;
+    }
+
+    int listen_fd = -1;
+    std::string listen_address;
+    std::vector<Viewer> viewers;
+};
+
+// the viewer side
+class StreamClient
+{
+public:
+    StreamClient() = default;
+    StreamClient(const StreamClient&) = delete;
+    StreamClient& operator=(const StreamClient&) = delete;
+    ~StreamClient() {close();}
+
+    void connect(const std::string& address)
+    {
+        close();
+        fd = openStreamSocket(address, false);
+    }
+
+    void close()
+    {
+#ifdef __linux__
+        if(fd >= 0) ::close(fd);
+#endif
+        fd = -1;
+        in.clear();
+        out.clear();
+    }
+
+    bool isConnected() const { return fd >= 0; }
+
+    // one command line, e.g. "pause" or "target 0.5 -0.2"; what the socket does not take
+    // now goes out with the next send() or receive(), lines stay whole and in order
+    void send(const std::string& command)
+    {
+        if(fd < 0) return;
+        out += command;
+        out += '\n';
+        flush();
+    }
+
+    // the newest whole message since the last call, false when none came;
+    // older ones are skipped, a viewer only draws the latest frame
+    bool receive(std::string& message)
+    {
+        bool found = false;
+        flush();
+#ifdef __linux__
+        char buffer[65536];
+        while(fd >= 0)
+        {
+            const ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+            if(got > 0) in.append(buffer, size_t(got));
+            else if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            else if(got == 0 || errno != EINTR)
+            {
+                ::close(fd); // the server is gone, the frames received so far still count
+                fd = -1;
+            }
+        }
+        size_t begin = 0;
+        for(uint32_t bytes;in.size() - begin >= sizeof(bytes);)
+        {
+            std::memcpy(&bytes, in.data() + begin, sizeof(bytes));
+            if(in.size() - begin - sizeof(bytes) < bytes) break;
+            message.assign(in, begin, sizeof(bytes) + bytes);
+            begin += sizeof(bytes) + bytes;
+            found = true;
+        }
+        in.erase(0, begin);
+#else
+        (void)message;
+#endif
+        return found;
+    }
+
+private:
+    void flush()
+    {
+#ifdef __linux__
+        size_t offset = 0;
+        while(fd >= 0 && offset < out.size())
+        {
+            const ssize_t put = ::send(fd, out.data() + offset, out.size() - offset, MSG_NOSIGNAL);
+            if(put >= 0) offset += size_t(put);
+            else if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            else if(errno != EINTR) close();
+        }
+        if(fd >= 0) out.erase(0, offset);
+#endif
+    }
+
+    int fd = -1;
+    std::string in;     // received, not yet a whole message
+    std::string out;    // command lines the socket did not take yet
+};
+#endif
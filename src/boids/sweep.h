@@ -0,0 +1,196 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "scenario.h"
+#include "work_stealing_pool.h"
+
+// Parameter sweep: every combination of the grid values, repeated with
+// different seeds, runs as one job on a work-stealing pool. CA_BEHAVE jobs
+// stop as soon as one team is wiped out. A result row is written as soon as
+// its job finishes, as csv or as json lines (".json"/".jsonl" output).
+// grid file:
+// {
+//     "grid": { "ck": [5, 10, 20], "rk": [250, 500], "strategy": [0, 3] },
+//     "repeats": 10,
+//     "output": "sweep.csv"
+// }
+// "boid_number", "method", "steps" and "seed" are scenario keys, every other grid key is a param;
+// an unknown key throws before any job runs, so no row is labeled with a value that was not applied.
+
+struct SweepJob
+{
+    int id = 0;
+    int repeat = 0;
+    nlohmann::json values; // one value per grid key
+};
+
+struct SweepResult
+{
+    int steps = 0;
+    int A_count = 0;
+    int B_count = 0;
+    bool decided = false;
+    double seconds = 0;
+};
+
+// cartesian product of the grid, repeats innermost
+inline std::vector<SweepJob> makeSweepJobs(const nlohmann::json& grid, int repeats)
+{
+    std::vector<SweepJob> jobs(1);
+    for(auto it = grid.begin(); it != grid.end(); ++it)
+    {
+        if(!it.value().is_array() || it.value().empty())
+            throw std::runtime_error("grid values of " + it.key() + " should be a non-empty array");
+        std::vector<SweepJob> expanded;
+        for(const SweepJob& job : jobs)
+        {
+            for(const nlohmann::json& value : it.value())
+            {
+                SweepJob next = job;
+                next.values[it.key()] = value;
+                expanded.push_back(next);
+            }
+        }
+        jobs.swap(expanded);
+    }
+    std::vector<SweepJob> repeated;
+    for(const SweepJob& job : jobs)
+    {
+        for(int r=0;r<repeats;r++)
+        {
+            SweepJob next = job;
+            next.id = int(repeated.size());
+            next.repeat = r;
+            repeated.push_back(next);
+        }
+    }
+    return repeated;
+}
+
+template <class T, int dim>
+Scenario<T, dim> applySweepJob(Scenario<T, dim> scenario, const SweepJob& job)
+{
+    nlohmann::json j;
+    j["params"] = nlohmann::json::object();
+    for(auto it = job.values.begin(); it != job.values.end(); ++it)
+    {
+        if(it.key() == "dim" || it.key() == "precision" || it.key() == "params")
+            throw std::runtime_error("grid key " + it.key() + " cannot be swept");
+        if(it.key() == "boid_number" || it.key() == "method" || it.key() == "steps" || it.key() == "seed") j[it.key()] = it.value();
+        else j["params"][it.key()] = it.value();
+    }
+    from_json(j, scenario); // throws on a key that is no param
+    scenario.seed += job.repeat;
+    scenario.params.verbose = false;
+    return scenario;
+}
+
+template <class T, int dim>
+SweepResult runSweepJob(const Scenario<T, dim>& scenario)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    Boids<T, dim> boids(scenario.boid_number, scenario.params);
+    boids.seed(scenario.seed);
+    boids.initializePositions(scenario.method);
+    boids.pause();
+    SweepResult result;
+    for(;result.steps<scenario.steps;result.steps++)
+    {
+        if(scenario.method == CA_BEHAVE && boids.isDecided()) break; // outcome decided, stop early
+        boids.updateBehavior(scenario.method);
+    }
+    if(scenario.method == CA_BEHAVE)
+    {
+        result.A_count = boids.get_A_count();
+        result.B_count = boids.get_B_count();
+        result.decided = boids.isDecided();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-start).count();
+    return result;
+}
+
+// streams one row per finished job, rows come in completion order
+class SweepWriter
+{
+public:
+    SweepWriter(const std::string& path, const nlohmann::json& grid) : file(path)
+    {
+        if(!file.is_open()) throw std::runtime_error("Failed to open sweep output " + path);
+        auto endsWith = [&](const std::string& ext) {
+            return path.size() >= ext.size() && path.compare(path.size()-ext.size(), ext.size(), ext) == 0;
+        };
+        json_lines = endsWith(".json") || endsWith(".jsonl");
+        for(auto it = grid.begin(); it != grid.end(); ++it) keys.push_back(it.key());
+        if(!json_lines)
+        {
+            file<<"job,repeat,seed";
+            for(const std::string& key : keys) file<<","<<key;
+            file<<",steps,A_count,B_count,winner,seconds"<<'\n';
+            file.flush();
+        }
+    }
+
+    void write(const SweepJob& job, unsigned int seed, const SweepResult& result)
+    {
+        const char* winner = !result.decided ? "none" : result.A_count > 0 ? "A" : result.B_count > 0 ? "B" : "draw";
+        std::lock_guard<std::mutex> lock(mutex);
+        if(json_lines)
+        {
+            nlohmann::json row;
+            row["job"] = job.id;
+            row["repeat"] = job.repeat;
+            row["seed"] = seed;
+            row["values"] = job.values;
+            row["steps"] = result.steps;
+            row["A_count"] = result.A_count;
+            row["B_count"] = result.B_count;
+            row["winner"] = winner;
+            row["seconds"] = result.seconds;
+            file<<row.dump()<<'\n';
+        }
+        else
+        {
+            file<<job.id<<","<<job.repeat<<","<<seed;
+            for(const std::string& key : keys) file<<","<<job.values[key].dump();
+            file<<","<<result.steps<<","<<result.A_count<<","<<result.B_count<<","<<winner<<","<<result.seconds<<'\n';
+        }
+        file.flush();
+    }
+
+private:
+    std::ofstream file;
+    std::mutex mutex;
+    std::vector<std::string> keys;
+    bool json_lines = false;
+};
+
+// runs every job of the grid file on the pool, returns the wall time in seconds
+template <class T, int dim>
+double runSweep(const Scenario<T, dim>& base, const nlohmann::json& sweep, WorkStealingPool& pool)
+{
+    checkKeys(sweep, {"grid", "repeats", "output"}, "the sweep file");
+    const nlohmann::json& grid = sweep.at("grid");
+    std::vector<SweepJob> jobs = makeSweepJobs(grid, sweep.value("repeats", 1));
+
+    // apply every job up front, so a bad grid key or value throws here, before the output is
+    // opened and not inside a worker
+    std::vector<Scenario<T, dim>> scenarios;
+    for(const SweepJob& job : jobs) scenarios.push_back(applySweepJob(base, job));
+    SweepWriter writer(sweep.value("output", std::string("sweep.csv")), grid);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for(size_t k=0;k<jobs.size();k++)
+    {
+        pool.submit([&jobs, &scenarios, &writer, k](int) {
+            PROFILE_SCOPE("sweep job");
+            writer.write(jobs[k], scenarios[k].seed, runSweepJob(scenarios[k]));
+        });
+    }
+    pool.wait();
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-start).count();
+}
+#endif
@@ -3,6 +3,8 @@
 #include <imgui.h>
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "profiler.h"
+#include "profiler_panel.h"
 
 #define NANOVG_GL3_IMPLEMENTATION
 #include <nanovg.h>
@@ -195,23 +197,34 @@ void Application::setCallbacks() {
 }
 
 void Application::run() {
+    traceThreadName() = "main";
     while (!glfwWindowShouldClose(window))
     {
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        process();
+        {
+            PROFILE_SCOPE("process");
+            process();
+        }
 
-        draw();
+        {
+            PROFILE_SCOPE("draw");
+            draw();
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+        {
+            PROFILE_SCOPE("swap buffers");
 #ifdef SINGLE_BUFFER
-        glFlush();
+            glFlush();
 #else
-        glfwSwapBuffers(window);
+            glfwSwapBuffers(window);
 #endif
+        }
         glfwPollEvents();
+        Profiler::instance().endFrame();
     }
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
@@ -228,6 +241,7 @@ void Application::draw() {
 
     // nano vg
     {
+        PROFILE_SCOPE("nanovg");
         nvgBeginFrame(vg, width/pixelRatio, height/pixelRatio, pixelRatio);
         drawNanoVG();
         nvgEndFrame(vg);
@@ -239,6 +253,7 @@ void Application::draw() {
 
     // ImGui
     {
+        PROFILE_SCOPE("imgui");
         using namespace ImGui;
         NewFrame();
 
@@ -247,15 +262,12 @@ void Application::draw() {
             InputFloat("pixel ratio", &pixelRatio);
             InputInt("width", &width); SameLine();
             InputInt("height", &height);
-            float fps = 1.f/deltaTime;
-            static bool imguiFps = false;
-            LabelText("fps", "fps: %.1f", (imguiFps) ? ImGui::GetIO().Framerate : fps);
-            SameLine();
-            Checkbox("imgui fps", &imguiFps);
+            Checkbox("profiler", &showProfiler);
             ImGui::EndMenu();
         }
         EndMainMenuBar();
 
+        drawProfilerPanel(&showProfiler, 1.f/deltaTime);
         drawImGui();
 
         ImGui::EndFrame();
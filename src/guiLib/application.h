@@ -74,6 +74,7 @@ public:
     // timing
     float deltaTime = 0.0f;
     float lastFrame = 0.0f;
+    bool showProfiler = false;  // per-phase timings window, see profiler_panel.h
 
 public:
     Application(const char *title, int width, int height, std::string iconPath = CMM_ASSETS_FOLDER"/crl_icon_blue.png", std::string font_path = IMGUI_FONT_FOLDER"/Cousine-Regular.ttf");
@@ -0,0 +1,109 @@
+#include "profiler_panel.h"
+#include "profiler.h"
+#include "imgui_multiplot.h"
+
+#include <string>
+#include <vector>
+
+static float historyGetter(const void* data, int idx)
+{
+    return ((const float*)data)[idx];
+}
+
+static const void* phaseGetter(const void* const* datas, int idx)
+{
+    return datas[idx];
+}
+
+void drawProfilerPanel(bool* open, float fps)
+{
+    using namespace ImGui;
+    if(!*open) return;
+    if(!Begin("profiler", open))
+    {
+        End();
+        return;
+    }
+
+    bool enabled = Profiler::enabled;
+    if(Checkbox("enabled", &enabled)) Profiler::enabled = enabled;
+    SameLine();
+    if(Button("reset")) Profiler::instance().requestReset(); // the draw and imgui scopes are open
+    SameLine();
+    Text("fps: %.1f", fps);
+
+    // chrome trace of the next trace_frames frames, written next to the executable
+    static int trace_frames = 600;
+    static int trace_frames_left = 0;
+    if(trace_frames_left > 0)
+    {
+        Text("capturing trace, %d frames left", trace_frames_left);
+        if(--trace_frames_left == 0)
+        {
+            Tracer::instance().stop();
+            Tracer::instance().writeChromeTrace("boids_trace.json");
+        }
+    }
+    else
+    {
+        if(Button("capture trace"))
+        {
+            Tracer::instance().start();
+            trace_frames_left = trace_frames;
+        }
+        SameLine();
+        InputInt("frames", &trace_frames);
+    }
+
+    Profiler& profiler = Profiler::instance();
+    std::vector<int> order = profiler.treeOrder();
+    if(order.empty())
+    {
+        Text("no phases recorded yet");
+        End();
+        return;
+    }
+
+    // table: indented phase name, last frame, average over the history
+    static const ImColor palette[] = {
+        ImColor(220,50,50), ImColor(50,50,220), ImColor(50,160,50), ImColor(200,130,0),
+        ImColor(150,50,200), ImColor(0,160,160), ImColor(120,120,120), ImColor(200,50,150)};
+    const int palette_size = sizeof(palette)/sizeof(palette[0]);
+    int last = (profiler.historyOffset() + Profiler::history_size - 1) % Profiler::history_size;
+
+    std::vector<std::string> labels;
+    std::vector<const char*> names;
+    std::vector<ImColor> colors;
+    std::vector<const void*> datas;
+    float max_ms = 0.f;
+    Columns(3, "phases");
+    Text("phase"); NextColumn(); Text("last [ms]"); NextColumn(); Text("avg [ms]"); NextColumn();
+    Separator();
+    for(size_t k=0;k<order.size();k++)
+    {
+        Profiler::Phase& phase = profiler.phase(order[k]);
+        float avg = 0.f;
+        for(float ms : phase.history)
+        {
+            avg += ms;
+            if(ms > max_ms) max_ms = ms;
+        }
+        avg /= Profiler::history_size;
+        ImColor color = palette[k % palette_size];
+        TextColored(color, "%s%s", std::string(2*phase.depth, ' ').c_str(), phase.name.c_str()); NextColumn();
+        Text("%.3f", phase.history[last]); NextColumn();
+        Text("%.3f", avg); NextColumn();
+
+        labels.push_back(std::string(2*phase.depth, ' ') + phase.name);
+        colors.push_back(color);
+        datas.push_back(phase.history.data());
+    }
+    Columns(1);
+    for(const std::string& label : labels) names.push_back(label.c_str());
+
+    PlotMultiEx(ImGuiPlotType_Lines, "ms/frame", int(datas.size()), names.data(), colors.data(),
+                &historyGetter, &phaseGetter, datas.data(),
+                Profiler::history_size, Profiler::history_size, profiler.historyOffset(),
+                0.f, max_ms > 0.f ? max_ms : 1.f, ImVec2(0, 150), false);
+    End();
+}
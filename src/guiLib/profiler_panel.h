@@ -0,0 +1,6 @@
+#pragma once
+
+// ImGui window with the per-phase timings of the Profiler: a table in tree
+// order and a rolling plot of the last frames, one line per phase. It can also
+// capture a chrome trace of the next frames into boids_trace.json.
+void drawProfilerPanel(bool* open, float fps);
@@ -0,0 +1,445 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "ensemble.h"
+#include "shared_state.h"
+#include "stream.h"
+#include "sweep.h"
+
+// headless runner: simulate a scenario file without opening a window
+// usage: runner <scenario.json> [--steps N] [--threads N] [--dump] [--profile] [--perf] [--trace out.json [--trace-capacity N]]
+//        runner <scenario.json> --ensemble K [--threads N]    K independent CA_BEHAVE games
+//        runner <scenario.json> --sweep grid.json [--threads N]    parameter sweep, see sweep.h
+// --threads N sets the workers of every mode, 0 (default) one per hardware thread
+// --perf adds hardware counters (cycles, instructions, cache and branch misses) per phase, per boid and step
+// --trace writes the last --trace-capacity events of every thread in the Chrome trace format
+// --publish name writes the state every --publish-every steps to the shared memory /name (shared_state.h),
+//        runner --watch name [--steps N]    reads it from another process, one line per frame,
+//        until N frames or one second without a new one
+// --serve unix:<path> | tcp:<port> streams the positions to viewers (stream.h, app --connect), one step
+//        and frame per 1/--serve-fps seconds (default 60, as the app; 0 full speed); viewers send the lines
+//        "pause" (toggles), "reinit", "target x y [z]" (the mouse target), "obstacle k x y" (moves obstacle k),
+//        "method <name or number>", "quit"
+// the "dim" and "precision" of the scenario file pick Boids<float|double, 2|3>
+
+void printUsage()
+{
+    std::cout<<"usage: runner <scenario.json> [--steps N] [--threads N] [--dump] [--profile] [--perf] [--trace out.json [--trace-capacity N]]"<<'\n';
+    std::cout<<"                                [--publish name [--publish-every K]] [--serve address [--serve-fps F]]"<<'\n';
+    std::cout<<"       runner <scenario.json> --ensemble K [--threads N] [--steps N]"<<'\n';
+    std::cout<<"       runner <scenario.json> --sweep grid.json [--threads N] [--steps N]"<<'\n';
+    std::cout<<"       runner --watch name [--steps N]"<<'\n';
+    std::cout<<"--threads N: workers of every mode, default one per hardware thread"<<'\n';
+}
+
+// where the state goes while the scenario runs, nothing with empty names
+struct PublishOptions
+{
+    std::string name;       // shared memory, every K steps
+    int every = 1;
+    std::string serve;      // stream address, see stream.h
+    int fps = 60;           // streaming: steps and frames per second, 0 unpaced
+};
+
+// the CA_BEHAVE teams side by side, A first
+template <class T, int dim>
+void teamStacks(Boids<T, dim>& boids, Matrix<T, dim, Eigen::Dynamic>& pos, Matrix<T, dim, Eigen::Dynamic>& vel)
+{
+    pos.resize(dim, boids.get_A_count() + boids.get_B_count());
+    vel.resize(dim, pos.cols());
+    pos<<boids.get_A_pos(), boids.get_B_pos();
+    vel<<boids.get_A_vel(), boids.get_B_vel();
+}
+
+template <class T, int dim>
+void publishState(Boids<T, dim>& boids, MethodTypes method, uint64_t step, SharedStatePublisher<T, dim>& publisher, bool& cut)
+{
+    bool complete;
+    int total;
+    if(method != CA_BEHAVE)
+    {
+        complete = publisher.publish(boids.getPositions(), boids.getVelocities(), step, double(boids.getTime()));
+        total = int(boids.getPositions().cols());
+    }
+    else
+    {
+        Matrix<T, dim, Eigen::Dynamic> pos, vel;
+        teamStacks(boids, pos, vel);
+        complete = publisher.publish(pos, vel, step, double(boids.getTime()), boids.get_A_count());
+        total = int(pos.cols());
+    }
+    // once, the header tells the readers of every cut frame
+    if(!complete && !cut)
+    {
+        std::cerr<<"warning: "<<total<<" boids do not fit the shared memory capacity of "<<publisher.capacity()
+                 <<", the frames leave out the rest (set population_cap to bound CA_BEHAVE)"<<'\n';
+        cut = true;
+    }
+}
+
+template <class T, int dim>
+void streamState(Boids<T, dim>& boids, MethodTypes method, uint64_t step, StreamServer& server, std::string& message)
+{
+    if(server.viewerCount() == 0) return;
+    if(method == CA_BEHAVE)
+    {
+        Matrix<T, dim, Eigen::Dynamic> pos, vel;
+        teamStacks(boids, pos, vel);
+        encodeFrame(pos, method, step, 0, boids.get_A_count(), message);
+    }
+    else
+    {
+        const int leaders = method == LEADER ? std::max(int(boids.getGroupStart().size()) - 1, 1) : 0;
+        encodeFrame(boids.getPositions(), method, step, leaders, 0, message);
+    }
+    server.broadcast(message);
+}
+
+// a viewer's command line, false when it is not one
+template <class T, int dim>
+bool applyCommand(Boids<T, dim>& boids, MethodTypes& method, const std::string& command, bool& paused, bool& quit)
+{
+    std::istringstream in(command);
+    std::string word;
+    in>>word;
+    if(word == "pause") paused = !paused;
+    else if(word == "reinit") boids.initializePositions(method);
+    else if(word == "quit") quit = true;
+    else if(word == "target")
+    {
+        // a 2d viewer of a 3d flock leaves z at 0
+        Vector<T, dim> target = Vector<T, dim>::Zero();
+        double x;
+        int read = 0;
+        for(;read<dim && in>>x;read++) target[read] = T(x);
+        if(read < 2) return false;
+        boids.getMousePos(target);
+    }
+    else if(word == "obstacle")
+    {
+        // moves obstacle k of the set to (x, y), as a click in the app does
+        int k;
+        double x, y;
+        if(!(in>>k>>x>>y) || k < 0 || k >= int(boids.getObstacles().size())) return false;
+        boids.moveObstacle(k, Vector<T, 2>(T(x), T(y)));
+    }
+    else if(word == "method")
+    {
+        std::string name;
+        in>>name;
+        try
+        {
+            const bool number = !name.empty() && name.find_first_not_of("0123456789") == std::string::npos;
+            method = parseMethod(number ? nlohmann::json(atoi(name.c_str())) : nlohmann::json(name));
+        }
+        catch(const std::exception&)
+        {
+            return false;
+        }
+        boids.initializePositions(method); // as the app does on a switch
+    }
+    else return false;
+    return true;
+}
+
+// the reader side of --publish, prints the frames of another runner
+template <class T, int dim>
+int watch(const std::string& name, int frames)
+{
+    SharedStateReader<T, dim> reader;
+    reader.open(name);
+    uint64_t last = 0;
+    int printed = 0;
+    auto seen = std::chrono::steady_clock::now();
+    while(frames < 0 || printed < frames)
+    {
+        if(reader.latestFrame() == last)
+        {
+            if(std::chrono::steady_clock::now() - seen > std::chrono::seconds(1)) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        reader.read([&](const typename SharedStateReader<T, dim>::StackMap& pos, const typename SharedStateReader<T, dim>::StackMap& vel,
+                        const SharedFrame& frame) {
+            last = frame.frame;
+            std::cout<<"frame "<<frame.frame<<", step "<<frame.step<<", time "<<frame.time<<", "<<pos.cols()<<" boids";
+            if(frame.total > pos.cols()) std::cout<<" of "<<frame.total<<" (cut at capacity)";
+            if(frame.team_a > 0) std::cout<<" ("<<frame.team_a<<" A)";
+            if(pos.cols() > 0)
+            {
+                const Vector<T, dim> mean_pos = pos.rowwise().mean(), mean_vel = vel.rowwise().mean();
+                std::cout<<", mean position (";
+                for(int d=0;d<dim;d++) std::cout<<(d > 0 ? "," : "")<<mean_pos[d];
+                std::cout<<"), mean velocity (";
+                for(int d=0;d<dim;d++) std::cout<<(d > 0 ? "," : "")<<mean_vel[d];
+                std::cout<<")";
+            }
+        });
+        std::cout<<'\n';
+        printed++;
+        seen = std::chrono::steady_clock::now();
+    }
+    std::cout<<"watched "<<printed<<" frames of "<<reader.name()<<", "<<reader.retries<<" reads retried"<<'\n';
+    return 0;
+}
+
+// run the scenario in the selected mode, returns the exit code
+template <class T, int dim>
+int run(const Scenario<T, dim>& scenario, const std::string& sweep_path, int games, int threads, bool dump,
+        const PublishOptions& publish)
+{
+    typedef Matrix<T, dim, Eigen::Dynamic> TVStack;
+    typedef Vector<T, dim> TV;
+
+    if(!sweep_path.empty())
+    {
+        try
+        {
+            std::ifstream file(sweep_path);
+            if(!file.is_open()) throw std::runtime_error("Failed to open sweep file " + sweep_path);
+            nlohmann::json sweep;
+            file >> sweep;
+            WorkStealingPool pool(threads);
+            double seconds = runSweep(scenario, sweep, pool);
+            std::cout<<"sweep done in "<<seconds<<" s on "<<pool.size()<<" threads, results in "<<sweep.value("output", std::string("sweep.csv"))<<'\n';
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr<<e.what()<<'\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    if(games > 0)
+    {
+        if(scenario.method != CA_BEHAVE)
+        {
+            std::cerr<<"--ensemble needs a CA_BEHAVE scenario"<<'\n';
+            return 1;
+        }
+        ThreadPool pool(threads);
+        Ensemble<T, dim> ensemble(scenario, games);
+        EnsembleStats stats = ensemble.run(pool, scenario.steps);
+        std::cout<<"ensemble: "<<stats.games<<" games of "<<scenario.boid_number<<" boids, strategy "<<scenario.params.strategy<<", "<<pool.size()<<" threads"<<'\n';
+        std::cout<<"A wins: "<<stats.wins_A<<", B wins: "<<stats.wins_B<<", draws: "<<stats.draws<<'\n';
+        std::cout<<"mean game length: "<<stats.mean_steps<<" steps"<<'\n';
+        std::cout<<"time: "<<stats.seconds<<" s ("<<stats.gamesPerSecond()<<" games/s)"<<'\n';
+        return 0;
+    }
+
+    Boids<T, dim> boids(scenario.boid_number, scenario.params);
+    ThreadPool pool(threads); // --threads: LEADER follow groups and the CA_BEHAVE breeding run in parallel
+    boids.setThreadPool(&pool);
+    boids.seed(scenario.seed);
+    boids.initializePositions(scenario.method);
+    boids.pause(); // boids start paused, as in the GUI
+
+    MethodTypes method = scenario.method; // viewers can switch it
+    // room for the largest state of any method that can run, viewers can switch to CA_BEHAVE, whose
+    // teams grow up to their cap (or a guessed 4x without one; publishState() warns when they pass it)
+    SharedStatePublisher<T, dim> publisher;
+    bool cut = false;
+    if(!publish.name.empty())
+    {
+        int capacity = scenario.boid_number;
+        if(scenario.method == CA_BEHAVE || !publish.serve.empty())
+            capacity = std::max(capacity, scenario.params.population_cap > 0 ? 2*scenario.params.population_cap : 4*scenario.boid_number);
+        publisher.open(publish.name, capacity);
+        publishState(boids, method, 0, publisher, cut);
+    }
+    StreamServer server;
+    if(!publish.serve.empty())
+    {
+        server.listen(publish.serve);
+        std::cout<<"serving on "<<server.address()<<'\n';
+    }
+    std::vector<std::string> commands;
+    std::string message;
+    bool paused = false, quit = false;
+    const auto frame_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(publish.fps > 0 ? 1./publish.fps : 0.));
+    auto next_frame = std::chrono::steady_clock::now();
+
+    int step = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while(step < scenario.steps && !quit)
+    {
+        if(server.isOpen())
+        {
+            commands.clear();
+            server.poll(commands);
+            for(const std::string& command : commands)
+                if(!applyCommand(boids, method, command, paused, quit)) std::cerr<<"unknown command "<<command<<'\n';
+        }
+        if(!paused)
+        {
+            boids.updateBehavior(method);
+            step++;
+            if(publisher.isOpen() && step % publish.every == 0) publishState(boids, method, step, publisher, cut);
+        }
+        if(server.isOpen())
+        {
+            streamState(boids, method, step, server, message);
+            if(publish.fps > 0)
+            {
+                // paced like the app, after a slow step the next ones do not hurry to catch up
+                next_frame = std::max(next_frame + frame_time, std::chrono::steady_clock::now());
+                std::this_thread::sleep_until(next_frame);
+            }
+            else if(paused) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        Profiler::instance().endFrame();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end-start).count();
+
+    std::cout<<"scenario: "<<methodName(method)<<", "<<dim<<"d, "<<(sizeof(T) == sizeof(double) ? "double, " : "")<<scenario.boid_number<<" boids, "<<step<<" steps"<<'\n';
+    std::cout<<"time: "<<seconds<<" s ("<<step/seconds<<" steps/s)"<<'\n';
+    if(publisher.isOpen())
+        std::cout<<"published every "<<publish.every<<" steps to shared memory "<<publisher.name()<<", capacity "<<publisher.capacity()<<" boids"<<'\n';
+    if(server.isOpen())
+        std::cout<<"streamed on "<<server.address()<<": "<<server.sent<<" frames sent, "<<server.dropped<<" dropped, "<<server.viewerCount()<<" viewers at the end"<<'\n';
+    if(Profiler::count_events)
+    {
+        if(!PerfCounters::thisThread().available()) std::cout<<"perf counters unavailable (check /proc/sys/kernel/perf_event_paranoid, or the NMI watchdog holds a counter)"<<'\n';
+        std::cout<<"per boid and step:"<<'\n';
+        Profiler::instance().printCounters(std::cout, double(scenario.boid_number)*step);
+    }
+    else if(Profiler::enabled) Profiler::instance().print(std::cout);
+    if(!boids.getGroupStart().empty())
+        std::cout<<"leader groups: "<<boids.getGroupStart().size()-1<<", "<<boids.getRegrouped()<<" followers changed group, "<<pool.size()<<" threads"<<'\n';
+    if(scenario.params.sleeping)
+        std::cout<<"sleeping: "<<100*boids.getSleepingFraction()<<"% of the boids"<<'\n';
+    const RepulsionSolver<T, dim>& solver = boids.getRepulsionSolver();
+    if(solver.solves > 0)
+        std::cout<<"implicit repulsion: "<<solver.solves<<" solves, "<<double(solver.iterations)/solver.solves<<" cg iterations per solve"<<'\n';
+    if(method == CA_BEHAVE)
+    {
+        std::cout<<"Boids A vs Boids B: "<<boids.get_A_count()<<":"<<boids.get_B_count()<<'\n';
+        return 0;
+    }
+    const IntegratorState<T, dim>& integration = boids.getIntegratorState();
+    std::cout<<"integrator: "<<getIntegrator<T, dim>(scenario.params.updateMode).name()<<", simulated time "<<boids.getTime()
+             <<", "<<boids.getForceEvaluations()<<" force evaluations ("<<boids.getWideEvaluations()<<" with cohesion/alignment)"<<'\n';
+    if(scenario.params.updateMode == ADAPTIVE)
+        std::cout<<"adaptive steps: "<<integration.accepted<<" accepted, "<<integration.rejected<<" rejected, "<<integration.forced<<" over the tolerance, next h "<<integration.next_h<<'\n';
+    TVStack pos = boids.getPositions();
+    TVStack vel = boids.getVelocities();
+    TV mean_pos = pos.rowwise().mean();
+    std::cout<<"mean position: (";
+    for(int d=0;d<dim;d++) std::cout<<(d > 0 ? "," : "")<<mean_pos[d];
+    std::cout<<")"<<'\n';
+    if(dump)
+    {
+        for(int i=0;i<pos.cols();i++)
+        {
+            std::cout<<i;
+            for(int d=0;d<dim;d++) std::cout<<" "<<pos(d,i);
+            for(int d=0;d<dim;d++) std::cout<<" "<<vel(d,i);
+            std::cout<<'\n';
+        }
+    }
+    return 0;
+}
+
+template <class T, int dim>
+int loadAndRun(const std::string& path, int steps, const std::string& sweep_path, int games, int threads, bool dump,
+               const PublishOptions& publish)
+{
+    Scenario<T, dim> scenario = loadScenario<T, dim>(path);
+    if(steps >= 0) scenario.steps = steps;
+    return run(scenario, sweep_path, games, threads, dump, publish);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printUsage();
+        return 1;
+    }
+    int steps = -1;
+    bool dump = false;
+    int games = 0;
+    int threads = 0;
+    std::string sweep_path;
+    std::string trace_path;
+    int trace_capacity = 1 << 18;
+    PublishOptions publish;
+    std::string watch_name;
+    int first = 2;
+    if(!strcmp(argv[1], "--watch") && argc > 2)
+    {
+        watch_name = argv[2];
+        first = 3;
+    }
+    for(int i=first;i<argc;i++)
+    {
+        if(!strcmp(argv[i], "--steps") && i+1 < argc) steps = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--dump")) dump = true;
+        else if(!strcmp(argv[i], "--profile")) Profiler::enabled = true;
+        else if(!strcmp(argv[i], "--perf")) Profiler::enabled = Profiler::count_events = true;
+        else if(!strcmp(argv[i], "--trace") && i+1 < argc) trace_path = argv[++i];
+        else if(!strcmp(argv[i], "--trace-capacity") && i+1 < argc) trace_capacity = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--ensemble") && i+1 < argc) games = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--sweep") && i+1 < argc) sweep_path = argv[++i];
+        else if(!strcmp(argv[i], "--publish") && i+1 < argc) publish.name = argv[++i];
+        else if(!strcmp(argv[i], "--publish-every") && i+1 < argc) publish.every = std::max(atoi(argv[++i]), 1);
+        else if(!strcmp(argv[i], "--serve") && i+1 < argc) publish.serve = argv[++i];
+        else if(!strcmp(argv[i], "--serve-fps") && i+1 < argc) publish.fps = std::max(atoi(argv[++i]), 0);
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if(!watch_name.empty())
+    {
+        try
+        {
+            int segment_dim, scalar_bytes;
+            sharedStateFormat(watch_name, segment_dim, scalar_bytes);
+            if(segment_dim == 3) return scalar_bytes == 8 ? watch<double, 3>(watch_name, steps) : watch<float, 3>(watch_name, steps);
+            return scalar_bytes == 8 ? watch<double, 2>(watch_name, steps) : watch<float, 2>(watch_name, steps);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr<<e.what()<<'\n';
+            return 1;
+        }
+    }
+
+    traceThreadName() = "main";
+    if(!trace_path.empty()) Tracer::instance().start(trace_capacity);
+    int result = 1;
+    try
+    {
+        const bool is_double = scenarioPrecision(argv[1]) == "double";
+        if(scenarioDim(argv[1]) == 3)
+            result = is_double ? loadAndRun<double, 3>(argv[1], steps, sweep_path, games, threads, dump, publish)
+                               : loadAndRun<float, 3>(argv[1], steps, sweep_path, games, threads, dump, publish);
+        else
+            result = is_double ? loadAndRun<double, 2>(argv[1], steps, sweep_path, games, threads, dump, publish)
+                               : loadAndRun<float, 2>(argv[1], steps, sweep_path, games, threads, dump, publish);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr<<e.what()<<'\n';
+    }
+    if(!trace_path.empty())
+    {
+        Tracer::instance().stop();
+        uint64_t events = Tracer::instance().eventCount();
+        if(Tracer::instance().writeChromeTrace(trace_path))
+            std::cout<<"trace: "<<events<<" events written to "<<trace_path<<'\n';
+        else
+            std::cerr<<"Failed to write trace "<<trace_path<<'\n';
+    }
+    return result;
+}
@@ -0,0 +1,42 @@
+#include "boids.h"
+#include "check.h"
+
+// one breeding pass of a CA_BEHAVE team on the grid, on 1 and 4 threads (more threads than cores
+// still check the determinism), must give the children of the pairwise loop it replaced, in order
+
+typedef Eigen::Matrix<float, 2, Eigen::Dynamic> TVStack;
+
+int main()
+{
+    ThreadPool pool(4);
+    for(int n : {40, 1000})
+    {
+        BoidsParams<float, 2> params;
+        params.verbose = false;
+        Boids<float, 2> boids(2*n, params);
+        boids.seed(1);
+        boids.initializePositions(CA_BEHAVE);
+        const TVStack pos = boids.get_A_pos(), vel = boids.get_A_vel();
+        TVStack reference_pos = pos, reference_vel = vel;
+        for(int i=0;i<n-1;i++)
+        {
+            for(int j=i+1;j<n;j++)
+            {
+                if((pos.col(i)-pos.col(j)).norm() >= params.breed_range) continue;
+                reference_pos.conservativeResize(2, reference_pos.cols()+1);
+                reference_pos.col(reference_pos.cols()-1) = (pos.col(i) + pos.col(j))/2;
+                reference_vel.conservativeResize(2, reference_vel.cols()+1);
+                reference_vel.col(reference_vel.cols()-1) = (vel.col(i) + vel.col(j))/2;
+            }
+        }
+        for(int threads : {1, 4})
+        {
+            boids.setThreadPool(threads > 1 ? &pool : nullptr);
+            TVStack bred_pos = pos, bred_vel = vel;
+            boids.breed(bred_pos, bred_vel);
+            std::cout<<n<<" parents, "<<threads<<" threads: "<<bred_pos.cols()-n<<" children, all pairs "<<reference_pos.cols()-n;
+            pass(bred_pos.cols() == reference_pos.cols() && bred_pos == reference_pos && bred_vel == reference_vel);
+        }
+    }
+    return testResult();
+}
@@ -0,0 +1,37 @@
+#ifndef CHECK_H
+#define CHECK_H
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// the pass/fail lines of the tests: each check ends its line with ok or FAILED and counts the
+// failures, main() returns testResult()
+
+inline int failed = 0;
+
+// ends the line of a check
+inline bool pass(bool ok)
+{
+    std::cout<<(ok ? "  ok" : "  FAILED")<<'\n';
+    if(!ok) failed++;
+    return ok;
+}
+
+// error against the scale of the reference, at most tolerance*scale
+inline bool checkDifference(const std::string& name, double error, double scale, double tolerance)
+{
+    std::cout<<std::left<<std::setw(28)<<name<<std::right<<"max difference "<<std::setw(12)<<error
+             <<" of "<<std::setw(12)<<scale;
+    return pass(error <= tolerance*scale);
+}
+
+// the same for the columns of two stacks, relative to the largest column of the reference
+template <class Stack>
+bool checkDifference(const std::string& name, const Stack& value, const Stack& reference, double tolerance)
+{
+    return checkDifference(name, double((value-reference).colwise().norm().maxCoeff()), double(reference.colwise().norm().maxCoeff()), tolerance);
+}
+
+inline int testResult() { return failed == 0 ? 0 : 1; }
+
+#endif
@@ -0,0 +1,69 @@
+#include <limits>
+#include <random>
+#include "boids.h"
+#include "check.h"
+
+// the goal flow field (flow_field.h) repaired after every move of an obstacle must hold the
+// path lengths of a fresh transform, around 10 and 100 random circles and squares
+
+typedef Eigen::Matrix<float, 2, 1> TV;
+
+int main()
+{
+    const float extent = 1.5f, clearance = 0.03f, band = 0.1f;
+    const TV goal(-1.4f, -1.4f);
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> place(-extent, extent), size(0.02f, 0.06f), jump(-0.1f, 0.1f);
+    for(int count : {10, 100})
+    {
+        for(float cell : {0.02f, 0.01f})
+        {
+            std::vector<Obstacle<float>> obstacles(count);
+            for(int k=0;k<count;k++)
+            {
+                obstacles[k].center = TV(place(rng), place(rng));
+                if((obstacles[k].center-goal).norm() < 0.3f) obstacles[k].center += TV(0.5f, 0.5f); // keep the goal reachable
+                const float r = size(rng);
+                if(k%2 == 0) obstacles[k].radius = r;
+                else obstacles[k].vertices = {TV(-r, -r), TV(r, -r), TV(r, r), TV(-r, r)};
+            }
+            ObstacleField<float> field;
+            field.build(obstacles, cell, band);
+            auto distance = [&](const TV& p) {
+                float d;
+                TV gradient;
+                return field.sample(p, d, gradient) ? d : band;
+            };
+            FlowField<float> flow;
+            flow.build(goal, extent, cell, clearance, distance);
+            for(int k=0;k<count;k++)
+            {
+                TV old_lo, old_hi, lo, hi;
+                obstacles[k].bounds(old_lo, old_hi);
+                obstacles[k].center += TV(jump(rng), jump(rng));
+                obstacles[k].bounds(lo, hi);
+                // the bilinear lookup spreads the change of the distance by one field cell
+                if(field.move(k, obstacles[k].center))
+                    flow.update(old_lo.cwiseMin(lo).array()-cell, old_hi.cwiseMax(hi).array()+cell, distance);
+                else
+                    flow.build(goal, extent, cell, clearance, distance); // the obstacle field grew, every distance changed
+            }
+
+            FlowField<float> fresh;
+            fresh.build(goal, extent, cell, clearance, distance);
+            float mismatch = 0;
+            for(float y=-extent;y<=extent;y+=cell)
+            {
+                for(float x=-extent;x<=extent;x+=cell)
+                {
+                    const float a = flow.pathLength(TV(x, y)), b = fresh.pathLength(TV(x, y));
+                    if(std::isinf(a) != std::isinf(b)) mismatch = std::numeric_limits<float>::infinity();
+                    else if(!std::isinf(a)) mismatch = std::max(mismatch, std::abs(a-b));
+                }
+            }
+            std::cout<<count<<" obstacles, cell "<<cell<<": max mismatch "<<mismatch;
+            pass(mismatch <= 1e-5f);
+        }
+    }
+    return testResult();
+}
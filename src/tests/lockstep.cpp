@@ -0,0 +1,44 @@
+#include "scenario.h"
+#include "check.h"
+
+// determinism test of Boids<fixed32, 2> (fixed_point.h): the state after steps steps of
+// LEADER and CA_BEHAVE must hash the same on 1 and 4 threads and match the hashes recorded
+// here, on any x86-64 build
+
+typedef Eigen::Matrix<fixed32, 2, Eigen::Dynamic> FixedStack;
+
+uint64_t runHash(MethodTypes type, int n, int steps, ThreadPool* pool)
+{
+    BoidsParams<fixed32, 2> params;
+    params.verbose = false;
+    params.leaders = 8;
+    params.breed_gap = 100;
+    params.population_cap = n;
+    Boids<fixed32, 2> boids(n, params);
+    boids.setThreadPool(pool); // the follow groups and the breeding
+    boids.seed(1);
+    boids.initializePositions(type);
+    boids.getMousePos(Vector<fixed32, 2>::Ones());
+    boids.pause();
+    for(int s=0;s<steps;s++) boids.updateBehavior(type);
+    if(type == CA_BEHAVE) return stateHash<2>({boids.get_A_pos(), boids.get_A_vel(), boids.get_B_pos(), boids.get_B_vel()});
+    return stateHash<2>({boids.getPositions(), boids.getVelocities()});
+}
+
+int main()
+{
+    const int n = 400, steps = 1000;
+    const MethodTypes types[] = {LEADER, CA_BEHAVE};
+    const uint64_t recorded[] = {0xfaeeb414fcb27c34ull, 0x4e9ee8af5c89100full};
+    ThreadPool pool(4);
+    for(int t=0;t<2;t++)
+    {
+        const uint64_t single = runHash(types[t], n, steps, nullptr);
+        const uint64_t threaded = runHash(types[t], n, steps, &pool);
+        std::cout<<std::left<<std::setw(16)<<methodName(types[t])<<std::right<<std::hex<<std::setfill('0')
+                 <<"recorded "<<std::setw(16)<<recorded[t]<<"  1 thread "<<std::setw(16)<<single
+                 <<"  4 threads "<<std::setw(16)<<threaded<<std::dec<<std::setfill(' ');
+        pass(single == recorded[t] && threaded == recorded[t]);
+    }
+    return testResult();
+}
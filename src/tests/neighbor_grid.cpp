@@ -0,0 +1,62 @@
+#include <string>
+#include "boids.h"
+#include "check.h"
+
+// the neighbor grid (spatial_grid.h) must give the forces of all pairs: COLLISION_AVOID in 2d and
+// 3d, and SEPARATION in a periodic box, where moving every boid by a third of the box (across the
+// seam) must not change the forces either; differences are relative to the largest force
+
+// the boids are spread over a box of side (n/40)^(1/d), the density of 40 boids in the unit box
+template <int d>
+void checkGrid(int n)
+{
+    typedef Eigen::Matrix<float, d, Eigen::Dynamic> Stack;
+    Stack acc[2];
+    for(int use_grid=0;use_grid<2;use_grid++)
+    {
+        BoidsParams<float, d> params;
+        params.neighbor_grid = use_grid;
+        Boids<float, d> boids(n, params);
+        boids.seed(1);
+        boids.initializePositions(COLLISION_AVOID);
+        const Stack pos = boids.getPositions()*float(std::pow(n/40., 1./d));
+        acc[use_grid] = boids.getAcc(COLLISION_AVOID, pos);
+    }
+    checkDifference("grid " + std::to_string(d) + "d", acc[1], acc[0], 1e-5);
+}
+
+// bulk flock of 100 boids per unit area
+void checkPeriodic(int n)
+{
+    typedef Eigen::Matrix<float, 2, Eigen::Dynamic> Stack;
+    BoidsParams<float, 2> params;
+    params.periodic = true;
+    params.period = std::sqrt(n/100.);
+    params.cohesion_radius = 0.2;
+    Stack all_pairs;
+    for(int use_grid=0;use_grid<2;use_grid++)
+    {
+        params.neighbor_grid = use_grid;
+        Boids<float, 2> boids(n, params);
+        boids.seed(1);
+        boids.initializePositions(SEPARATION);
+        const Stack pos = boids.getPositions();
+        const Stack acc = boids.getAcc(SEPARATION, pos);
+        // the shifted coordinates round, the forces of close pairs move a little more
+        const Stack shifted = pos.unaryExpr([&](float x) { return wrapCoordinate(x + float(params.period/3), float(params.period)); });
+        checkDifference(use_grid ? "periodic grid, shifted" : "periodic all pairs, shifted", boids.getAcc(SEPARATION, shifted), acc, 1e-4);
+        if(use_grid) checkDifference("periodic grid", acc, all_pairs, 1e-5);
+        else all_pairs = acc;
+    }
+}
+
+int main()
+{
+    for(int n : {40, 1000})
+    {
+        checkGrid<2>(n);
+        checkGrid<3>(n);
+        checkPeriodic(n);
+    }
+    return testResult();
+}
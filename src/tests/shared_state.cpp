@@ -0,0 +1,56 @@
+#include <atomic>
+#include <thread>
+#include "shared_state.h"
+#include "check.h"
+
+// publication to shared memory (shared_state.h): a writer thread publishes as fast as it can
+// against a reader that copies out every frame it gets (positions stamped with the frame number,
+// velocities with minus it) until it has checked 200 frames; no copy may be torn. Then a frame past
+// the capacity must come out cut, with its real size in the header
+
+typedef Eigen::Matrix<float, 2, Eigen::Dynamic> TVStack;
+
+int main()
+{
+    const int n = 1000, checks = 200, max_frames = 10000000;
+    SharedStatePublisher<float, 2> publisher;
+    publisher.open("boids_test", n);
+    SharedStateReader<float, 2> reader;
+    reader.open("boids_test");
+    std::atomic<bool> done(false);
+    std::atomic<int> read(0);
+    int frames = 0;
+    std::thread writer([&]() {
+        TVStack pos(2, n), vel(2, n);
+        for(int f=1;f<=max_frames && read < checks;f++)
+        {
+            frames = f;
+            pos.setConstant(float(f));
+            vel.setConstant(float(-f));
+            publisher.publish(pos, vel, f, 0);
+        }
+        done = true;
+    });
+    TVStack pos, vel;
+    SharedFrame frame{0, 0, 0, 0, 0};
+    uint64_t last = 0, torn = 0;
+    while(!done)
+    {
+        // fn of read() may run on a frame that the writer overtakes, only the copy that read() returns counts
+        if(!reader.copy(pos, vel, frame) || frame.frame == last) continue;
+        const float f = float(frame.frame);
+        if(pos.cols() != n || pos.minCoeff() != f || pos.maxCoeff() != f || vel.minCoeff() != -f || vel.maxCoeff() != -f || frame.step != frame.frame) torn++;
+        last = frame.frame;
+        read++;
+    }
+    writer.join();
+    std::cout<<n<<" boids, "<<frames<<" frames published, "<<read<<" read, "<<reader.retries<<" reads retried, "
+             <<torn<<" torn";
+    pass(torn == 0);
+
+    const bool complete = publisher.publish(TVStack::Zero(2, n+10), TVStack::Zero(2, n+10), 0, 0);
+    const bool cut = !complete && reader.copy(pos, vel, frame) && pos.cols() == n && frame.total == n+10;
+    std::cout<<n+10<<" boids into "<<n<<": "<<pos.cols()<<" published of "<<frame.total;
+    pass(cut);
+    return testResult();
+}
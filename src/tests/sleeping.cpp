@@ -0,0 +1,85 @@
+#include <vector>
+#include "boids.h"
+#include "check.h"
+
+// sleeping boids (BoidsParams::sleeping): a COLLISION_AVOID flock settles at the goal under
+// symplectic euler, velocity verlet, RK4 and r-RESPA; over the steps after the first boid fell
+// asleep, a boid asleep before and after a step must not move, also under the forces velocity
+// verlet and r-RESPA cache. Then an obstacle moved onto the sleeping flock must wake every
+// sleeper that sees it
+
+typedef Eigen::Matrix<float, 2, Eigen::Dynamic> TVStack;
+typedef Eigen::Matrix<float, 2, 1> TV;
+
+// sleepers within range of the box [lo, hi]
+int sleepersNear(Boids<float, 2>& boids, const TV& lo, const TV& hi, float range)
+{
+    int count = 0;
+    for(int i=0;i<boids.getPositions().cols();i++)
+    {
+        const TV p = boids.getPositions().col(i);
+        if(!boids.getAwake()[i] && (p - p.cwiseMax(lo).cwiseMin(hi)).norm() <= range) count++;
+    }
+    return count;
+}
+
+int main()
+{
+    const int modes[] = {SYMPLECTIC_EULER, VELOCITY_VERLET, RK4, MULTIRATE};
+    const char* names[] = {"symplectic euler", "velocity verlet", "RK4", "r-RESPA"};
+    for(int m=0;m<4;m++)
+    {
+        BoidsParams<float, 2> params;
+        params.verbose = false;
+        params.sleeping = true;
+        params.updateMode = modes[m];
+        params.eyesight_range = 0.2;
+        Obstacle<float> obstacle;
+        obstacle.center = TV(2, 2); // out of the way until it moves
+        obstacle.radius = 0.05;
+        params.obstacles = {obstacle};
+        Boids<float, 2> boids(40, params);
+        boids.seed(1);
+        boids.initializePositions(COLLISION_AVOID);
+        boids.pause();
+        int steps = 0;
+        while(boids.getSleepingFraction() == 0 && steps < 20000)
+        {
+            boids.updateBehavior(COLLISION_AVOID);
+            steps++;
+        }
+
+        int sleeper_steps = 0, moved = 0;
+        for(int s=0;s<500;s++)
+        {
+            const std::vector<char> awake = boids.getAwake();
+            const TVStack pos = boids.getPositions();
+            boids.updateBehavior(COLLISION_AVOID);
+            for(int i=0;i<pos.cols();i++)
+            {
+                if(awake[i] || boids.getAwake()[i]) continue;
+                sleeper_steps++;
+                if(boids.getPositions().col(i) != pos.col(i)) moved++;
+            }
+        }
+        std::cout<<names[m]<<": first sleeper after "<<steps<<" steps, then "<<sleeper_steps<<" sleeper steps, "<<moved<<" moved";
+        pass(sleeper_steps > 0 && moved == 0);
+
+        // until the flock sleeps, nothing else would wake it
+        while(boids.getSleepingFraction() < 1 && steps < 20000)
+        {
+            boids.updateBehavior(COLLISION_AVOID);
+            steps++;
+        }
+
+        obstacle.center = boids.getPositions().rowwise().mean();
+        TV lo, hi;
+        obstacle.bounds(lo, hi);
+        const int seeing = sleepersNear(boids, lo, hi, params.eyesight_range);
+        boids.moveObstacle(0, obstacle.center);
+        const int still = sleepersNear(boids, lo, hi, params.eyesight_range);
+        std::cout<<names[m]<<": obstacle moved onto the flock, "<<seeing<<" sleepers see it, "<<still<<" still asleep";
+        pass(seeing > 0 && still == 0);
+    }
+    return testResult();
+}
@@ -0,0 +1,54 @@
+#include <random>
+#include "boids.h"
+#include "check.h"
+
+// CA_BEHAVE under a population cap (slot_pool.h): the forces of a team in slots, with dead boids
+// left in the freed slots, must equal the forces of the same live boids packed without slots,
+// for the exact sums, the Barnes-Hut tree and the cell sums
+
+typedef Eigen::Matrix<float, 2, Eigen::Dynamic> TVStack;
+
+int main()
+{
+    const int capacity = 300, live_count = 200;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-0.5f, 0.5f);
+    TVStack pos(2, capacity), vel(2, capacity);
+    for(int k=0;k<pos.size();k++)
+    {
+        pos(k) = uniform(rng);
+        vel(k) = uniform(rng);
+    }
+    // every third slot is dead, among the live boids
+    SlotPool slots;
+    slots.reset(capacity, capacity);
+    for(int slot=0;slot<capacity && slots.size()>live_count;slot+=3) slots.release(slot);
+    TVStack live_pos(2, slots.size()), live_vel(2, slots.size());
+    std::vector<int> live;
+    for(int slot=0;slot<capacity;slot++)
+    {
+        if(!slots.alive(slot)) continue;
+        live_pos.col(live.size()) = pos.col(slot);
+        live_vel.col(live.size()) = vel.col(slot);
+        live.push_back(slot);
+    }
+
+    const char* names[] = {"exact", "tree", "cell sums"};
+    for(int sums : {EXACT_SUMS, TREE_SUMS, CELL_SUMS})
+    {
+        BoidsParams<float, 2> params;
+        params.verbose = false;
+        params.wide_sums = sums;
+        Boids<float, 2> boids(2, params);
+        const TVStack pooled = boids.CA_acc(pos, vel, false, ALL_FORCES, &slots);
+        const TVStack packed = boids.CA_acc(live_pos, live_vel, false, ALL_FORCES);
+        double error = 0, scale = 0;
+        for(size_t k=0;k<live.size();k++)
+        {
+            error = std::max(error, double((pooled.col(live[k])-packed.col(k)).norm()));
+            scale = std::max(scale, double(packed.col(k).norm()));
+        }
+        checkDifference(names[sums], error, scale, 1e-5);
+    }
+    return testResult();
+}
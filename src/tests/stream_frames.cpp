@@ -0,0 +1,65 @@
+#include <random>
+#include <stdexcept>
+#include "boids.h"
+#include "stream.h"
+#include "check.h"
+
+// stream frames (stream.h): decoded positions are off by at most half a step of the 16-bit grid
+// over the bounding box, in 2d and 3d, and a viewer of another dim gets an error, not a frame
+
+template <int dim>
+void checkRoundTrip(int n)
+{
+    typedef Eigen::Matrix<float, dim, Eigen::Dynamic> Stack;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-2.f, 3.f);
+    Stack pos(dim, n);
+    for(int k=0;k<pos.size();k++) pos(k) = uniform(rng);
+    std::string message;
+    encodeFrame(pos, COLLISION_AVOID, 7, 0, 0, message);
+    Stack decoded;
+    StreamFrameInfo info;
+    bool ok = decodeFrame(message, decoded, info) && decoded.cols() == n && info.step == 7 && info.method == COLLISION_AVOID;
+    double error = 0;
+    if(ok)
+    {
+        const Eigen::Matrix<float, dim, 1> box = pos.rowwise().maxCoeff() - pos.rowwise().minCoeff();
+        for(int d=0;d<dim;d++)
+        {
+            const double span = box[d] > 0 ? box[d] : 1; // one boid, the box is a point
+            error = std::max(error, (decoded.row(d)-pos.row(d)).cwiseAbs().maxCoeff()/span);
+        }
+        ok = error <= 1.01/131070; // float rounding of the box
+    }
+    std::cout<<dim<<"d, "<<n<<" boids: max error "<<error<<" of the box";
+    pass(ok);
+}
+
+int main()
+{
+    for(int n : {1, 1000})
+    {
+        checkRoundTrip<2>(n);
+        checkRoundTrip<3>(n);
+    }
+
+    Eigen::Matrix<float, 3, Eigen::Dynamic> pos = Eigen::Matrix<float, 3, Eigen::Dynamic>::Random(3, 10);
+    std::string message;
+    encodeFrame(pos, COLLISION_AVOID, 0, 0, 0, message);
+    Eigen::Matrix<float, 2, Eigen::Dynamic> decoded;
+    StreamFrameInfo info;
+    bool thrown = false;
+    std::string error = "no error";
+    try
+    {
+        decodeFrame(message, decoded, info);
+    }
+    catch(const std::runtime_error& e)
+    {
+        error = e.what();
+        thrown = true;
+    }
+    std::cout<<"3d frame in a 2d viewer: "<<error;
+    pass(thrown);
+    return testResult();
+}
@@ -0,0 +1,141 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+#include <cstdint>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters of the calling thread, read as one group
+// through Linux perf_event_open. Counters the kernel or the CPU refuses
+// (e.g. in a VM, or with perf_event_paranoid > 2) read as zero, valid()
+// tells which ones work. When the kernel multiplexes the group with other
+// events, the counts are scaled up by the time it was enabled over the time it
+// ran; a group that never ran (e.g. the NMI watchdog holds a counter) makes
+// read() fail and available() false. On other systems nothing is available.
+
+class PerfCounters
+{
+public:
+    enum Counter {CYCLES=0, INSTRUCTIONS=1, L1D_MISSES=2, LLC_MISSES=3, BRANCH_MISSES=4, COUNT=5};
+
+    static const char* name(int counter)
+    {
+        static const char* names[] = {"cycles", "instructions", "L1d misses", "LLC misses", "branch misses"};
+        return names[counter];
+    }
+
+    PerfCounters()
+    {
+        for(int k=0;k<COUNT;k++) fds[k] = -1;
+    }
+    ~PerfCounters() {close();}
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // returns false if not a single counter could be opened
+    bool open()
+    {
+#ifdef __linux__
+        close();
+        const uint32_t types[COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+        const uint64_t configs[COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,  // last level cache
+            PERF_COUNT_HW_BRANCH_MISSES};
+        int leader = -1;
+        opened = 0;
+        for(int k=0;k<COUNT;k++)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[k];
+            attr.config = configs[k];
+            attr.disabled = leader < 0 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            // this thread, any cpu
+            fds[k] = int(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+            if(fds[k] < 0) continue;
+            if(leader < 0) leader = fds[k];
+            slot[k] = opened++;
+        }
+        if(leader < 0) return false;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        group_fd = leader;
+        never_ran = false;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void close()
+    {
+#ifdef __linux__
+        for(int k=0;k<COUNT;k++)
+        {
+            if(fds[k] >= 0) ::close(fds[k]);
+            fds[k] = -1;
+        }
+#endif
+        group_fd = -1;
+        opened = 0;
+    }
+
+    bool available() const { return group_fd >= 0 && !never_ran; }
+    bool valid(int counter) const { return fds[counter] >= 0; }
+
+    // current totals since open(), one syscall for the whole group, scaled to the time the group was enabled
+    bool read(uint64_t values[COUNT]) const
+    {
+        for(int k=0;k<COUNT;k++) values[k] = 0;
+#ifdef __linux__
+        if(group_fd < 0) return false;
+        uint64_t buffer[3 + COUNT]; // nr, time enabled, time running, then one value per opened counter
+        if(::read(group_fd, buffer, sizeof(buffer)) < ssize_t(3*sizeof(uint64_t))) return false;
+        const uint64_t enabled = buffer[1], running = buffer[2];
+        if(running == 0)
+        {
+            never_ran = enabled > 0;
+            return false;
+        }
+        never_ran = false;
+        const double scale = running < enabled ? double(enabled)/running : 1.;
+        for(int k=0;k<COUNT;k++)
+            if(fds[k] >= 0 && slot[k] < int(buffer[0])) values[k] = uint64_t(double(buffer[3 + slot[k]])*scale);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // counters of the calling thread, opened on first use
+    static PerfCounters& thisThread()
+    {
+        static thread_local PerfCounters counters;
+        static thread_local bool tried = false;
+        if(!tried)
+        {
+            tried = true;
+            counters.open();
+        }
+        return counters;
+    }
+
+private:
+    int fds[COUNT];
+    int slot[COUNT] = {0};   // position of each counter in the group read
+    int group_fd = -1;
+    int opened = 0;
+    mutable bool never_ran = false; // enabled, but not scheduled on the pmu as of the last read
+};
+#endif
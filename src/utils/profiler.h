@@ -0,0 +1,261 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "perf_counters.h"
+#include "tracer.h"
+
+// Hierarchical phase profiler. PROFILE_SCOPE("name") times the enclosing
+// block; a scope opened inside another scope becomes its child phase.
+// Times are summed per frame, endFrame() moves them into a rolling history.
+// While Tracer::enabled is set, every scope is also recorded as a trace event.
+// With Profiler::count_events the scopes also sum the hardware counters of
+// perf_counters.h per phase.
+// When both are off a scope costs two relaxed loads, building with
+// BOIDS_NO_PROFILER removes the scopes completely.
+
+class Profiler
+{
+public:
+    static constexpr int history_size = 240; // frames kept for plotting
+
+    struct Phase
+    {
+        std::string name;
+        int parent = -1;
+        int depth = 0;
+        std::atomic<int64_t> frame_ns{0};    // time spent in the current frame, summed over threads
+        std::atomic<int64_t> frame_calls{0};
+        std::vector<float> history = std::vector<float>(history_size, 0.f); // ms per frame, ring buffer
+        double total_ms = 0;                 // over all finished frames
+        int64_t total_calls = 0;
+        std::atomic<uint64_t> frame_counters[PerfCounters::COUNT] = {};
+        double total_counters[PerfCounters::COUNT] = {};
+    };
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<bool> count_events{false}; // read perf counters in every scope
+
+    static Profiler& instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // id of the phase called name below parent (-1 = root), registered on first use
+    int phaseId(const char* name, int parent)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = std::make_pair(parent, std::string(name));
+        auto it = ids.find(key);
+        if(it != ids.end()) return it->second;
+        phases.emplace_back();
+        Phase& phase = phases.back();
+        phase.name = name;
+        phase.parent = parent;
+        phase.depth = parent < 0 ? 0 : phases[parent].depth + 1;
+        int id = int(phases.size()) - 1;
+        ids[key] = id;
+        return id;
+    }
+
+    // stays valid until reset()
+    Phase* phasePtr(int id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return &phases[id];
+    }
+
+    // call once per frame (or simulation step) from the main thread, with no scope open
+    void endFrame()
+    {
+        if(reset_requested.exchange(false))
+        {
+            reset();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for(Phase& phase : phases)
+        {
+            int64_t ns = phase.frame_ns.exchange(0);
+            phase.history[frame % history_size] = float(ns * 1e-6);
+            phase.total_ms += ns * 1e-6;
+            phase.total_calls += phase.frame_calls.exchange(0);
+            for(int k=0;k<PerfCounters::COUNT;k++)
+                phase.total_counters[k] += phase.frame_counters[k].exchange(0);
+        }
+        frame++;
+    }
+
+    // only call while no scope is open, the open scopes still point into the phases
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        phases.clear();
+        ids.clear();
+        frame = 0;
+        generation++;
+    }
+
+    // from inside a scope (a GUI button): the next endFrame() resets
+    void requestReset() { reset_requested = true; }
+
+    // phases in tree order: every phase directly followed by its children
+    std::vector<int> treeOrder()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<int> order;
+        appendChildren(-1, order);
+        return order;
+    }
+
+    Phase& phase(int id) { return phases[id]; }
+    int phaseCount() { return int(phases.size()); }
+    int64_t frameCount() const { return frame; }
+    int historyOffset() const { return int(frame % history_size); } // oldest entry of the ring buffers
+    int getGeneration() const { return generation; }
+
+    // average ms per frame of every phase, indented by depth
+    void print(std::ostream& os)
+    {
+        int64_t frames = frame > 0 ? frame : 1;
+        for(int id : treeOrder())
+        {
+            const Phase& p = phases[id];
+            os<<std::string(2*p.depth, ' ')<<std::left<<std::setw(24-2*p.depth)<<p.name<<std::right
+              <<std::setw(12)<<p.total_ms/frames<<" ms/frame"
+              <<std::setw(12)<<(p.total_calls > 0 ? 1e3*p.total_ms/p.total_calls : 0.)<<" us/call"<<'\n';
+        }
+    }
+
+    // time and hardware counters of every phase divided by units, e.g. boids*steps
+    void printCounters(std::ostream& os, double units)
+    {
+        const PerfCounters& counters = PerfCounters::thisThread();
+        os<<std::left<<std::setw(24)<<"phase"<<std::right<<std::setw(12)<<"ns";
+        for(int k=0;k<PerfCounters::COUNT;k++) os<<std::setw(15)<<PerfCounters::name(k);
+        os<<'\n';
+        for(int id : treeOrder())
+        {
+            const Phase& p = phases[id];
+            os<<std::string(2*p.depth, ' ')<<std::left<<std::setw(24-2*p.depth)<<p.name<<std::right
+              <<std::setw(12)<<1e6*p.total_ms/units;
+            for(int k=0;k<PerfCounters::COUNT;k++)
+            {
+                if(counters.available() && counters.valid(k)) os<<std::setw(15)<<p.total_counters[k]/units;
+                else os<<std::setw(15)<<"n/a";
+            }
+            os<<'\n';
+        }
+    }
+
+private:
+    void appendChildren(int parent, std::vector<int>& order)
+    {
+        for(int id=0;id<int(phases.size());id++)
+        {
+            if(phases[id].parent != parent) continue;
+            order.push_back(id);
+            appendChildren(id, order);
+        }
+    }
+
+    std::mutex mutex;
+    std::deque<Phase> phases; // deque: registering a phase does not move the others
+    std::map<std::pair<int, std::string>, int> ids;
+    int64_t frame = 0;
+    std::atomic<int> generation{0};
+    std::atomic<bool> reset_requested{false};
+};
+
+// innermost open phase of this thread
+inline int& currentPhase()
+{
+    static thread_local int current = -1;
+    return current;
+}
+
+// per call site and thread, saves the phase lookup
+struct ProfileSite
+{
+    int generation = -1;
+    int parent = -2;
+    int id = -1;
+    Profiler::Phase* phase = nullptr;
+};
+
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name, ProfileSite& site)
+    {
+        bool profiling = Profiler::enabled.load(std::memory_order_relaxed);
+        if(Tracer::enabled.load(std::memory_order_relaxed)) trace_name = name;
+        if(!profiling && !trace_name) return;
+        if(profiling)
+        {
+            Profiler& profiler = Profiler::instance();
+            int& current = currentPhase();
+            if(site.generation != profiler.getGeneration() || site.parent != current)
+            {
+                site.generation = profiler.getGeneration();
+                site.parent = current;
+                site.id = profiler.phaseId(name, current);
+                site.phase = profiler.phasePtr(site.id);
+            }
+            phase = site.phase;
+            parent = current;
+            current = site.id;
+            if(Profiler::count_events.load(std::memory_order_relaxed))
+                counting = PerfCounters::thisThread().read(start_counters);
+        }
+        start_ns = Tracer::now();
+    }
+    ~ProfileScope()
+    {
+        if(!phase && !trace_name) return;
+        int64_t end_ns = Tracer::now();
+        if(phase)
+        {
+            phase->frame_ns += end_ns - start_ns;
+            phase->frame_calls++;
+            uint64_t end_counters[PerfCounters::COUNT];
+            if(counting && PerfCounters::thisThread().read(end_counters))
+            {
+                for(int k=0;k<PerfCounters::COUNT;k++) phase->frame_counters[k] += end_counters[k] - start_counters[k];
+            }
+            currentPhase() = parent;
+        }
+        if(trace_name) Tracer::instance().record(trace_name, start_ns, end_ns);
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    Profiler::Phase* phase = nullptr;
+    const char* trace_name = nullptr;
+    bool counting = false;
+    uint64_t start_counters[PerfCounters::COUNT];
+    int parent = -1;
+    int64_t start_ns = 0;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifdef BOIDS_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) \
+    static thread_local ProfileSite PROFILE_CONCAT(profile_site_, __LINE__); \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name, PROFILE_CONCAT(profile_site_, __LINE__))
+#endif
+#endif
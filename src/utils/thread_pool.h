@@ -0,0 +1,97 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "tracer.h"
+
+// Fixed set of worker threads. parallelFor hands out indices dynamically, so
+// jobs of very different length still keep every worker busy.
+class ThreadPool
+{
+public:
+    // threads = 0 -> one worker per hardware thread
+    ThreadPool(int threads = 0)
+    {
+        if(threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        // the calling thread takes part in parallelFor, so start threads-1 workers
+        for(int t=1;t<threads;t++)
+            workers.emplace_back([this, t]() {workerLoop(t);});
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for(auto& w : workers) w.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return int(workers.size()) + 1; }
+
+    // call fn(i, thread) for every i in [begin, end), blocks until all calls returned
+    // thread is in [0, size()), 0 is the calling thread
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& fn)
+    {
+        if(end <= begin) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            next = begin;
+            last = end;
+            busy = int(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+        runJob(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() {return busy == 0;});
+        job = nullptr;
+    }
+
+private:
+    void runJob(int thread)
+    {
+        for(int i = next++; i < last; i = next++)
+            (*job)(i, thread);
+    }
+    void workerLoop(int thread)
+    {
+        traceThreadName() = "pool worker " + std::to_string(thread);
+        int seen = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() {return stop || generation != seen;});
+                if(stop) return;
+                seen = generation;
+            }
+            runJob(thread);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy--;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int, int)>* job = nullptr;
+    std::atomic<int> next{0};
+    int last = 0;
+    int busy = 0;
+    int generation = 0;
+    bool stop = false;
+};
+#endif
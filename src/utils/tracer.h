@@ -0,0 +1,153 @@
+#ifndef TRACER_H
+#define TRACER_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Opt-in event tracer for offline inspection. While Tracer::enabled is set,
+// every PROFILE_SCOPE also records its begin and end time into a ring buffer
+// owned by the calling thread. Only the owner writes into its buffer, so
+// recording takes no lock; once the buffer is full the oldest events are
+// overwritten. writeChromeTrace() dumps all buffers in the Chrome trace event
+// format, which chrome://tracing and ui.perfetto.dev open directly.
+
+struct TraceEvent
+{
+    const char* name;   // string literal of the PROFILE_SCOPE
+    int64_t begin_ns;
+    int64_t end_ns;
+};
+
+class TraceBuffer
+{
+public:
+    TraceBuffer(size_t capacity, int tid, const std::string& thread_name)
+        : events(capacity), tid(tid), thread_name(thread_name) {}
+
+    // owner thread only
+    void push(const char* name, int64_t begin_ns, int64_t end_ns)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        events[h % events.size()] = TraceEvent{name, begin_ns, end_ns};
+        head.store(h+1, std::memory_order_release);
+    }
+
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head{0};   // number of events ever pushed
+    int tid;
+    std::string thread_name;
+};
+
+// name shown for the current thread in the trace viewer
+inline std::string& traceThreadName()
+{
+    static thread_local std::string name;
+    return name;
+}
+
+class Tracer
+{
+public:
+    static inline std::atomic<bool> enabled{false};
+
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // drop old events and start recording, capacity = events kept per thread
+    // call while no thread is recording
+    void start(size_t capacity = 1 << 18)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->capacity = capacity;
+        generation++;
+        buffers.clear();
+        origin_ns = now();
+        enabled = true;
+    }
+
+    void stop()
+    {
+        enabled = false;
+    }
+
+    void record(const char* name, int64_t begin_ns, int64_t end_ns)
+    {
+        static thread_local TraceBuffer* buffer = nullptr;
+        static thread_local int buffer_generation = -1;
+        if(buffer_generation != generation.load(std::memory_order_acquire))
+        {
+            buffer = registerThread();
+            buffer_generation = generation;
+        }
+        buffer->push(name, begin_ns, end_ns);
+    }
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // call after stop(), while no thread is recording
+    bool writeChromeTrace(const std::string& path)
+    {
+        std::ofstream file(path);
+        if(!file.is_open()) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        file<<std::fixed<<std::setprecision(3);
+        file<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for(const auto& buffer : buffers)
+        {
+            file<<(first ? "" : ",")<<"\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<buffer->tid
+                <<",\"args\":{\"name\":\""<<buffer->thread_name<<"\"}}";
+            first = false;
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t size = buffer->events.size();
+            for(uint64_t e = head > size ? head-size : 0; e < head; e++)
+            {
+                const TraceEvent& event = buffer->events[e % size];
+                // complete event, ts and dur in microseconds
+                file<<",\n{\"name\":\""<<event.name<<"\",\"ph\":\"X\",\"pid\":1,\"tid\":"<<buffer->tid
+                    <<",\"ts\":"<<(event.begin_ns-origin_ns)*1e-3<<",\"dur\":"<<(event.end_ns-event.begin_ns)*1e-3<<"}";
+            }
+        }
+        file<<"\n]}\n";
+        return bool(file);
+    }
+
+    uint64_t eventCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t count = 0;
+        for(const auto& buffer : buffers)
+            count += std::min<uint64_t>(buffer->head.load(), buffer->events.size());
+        return count;
+    }
+
+private:
+    TraceBuffer* registerThread()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int tid = int(buffers.size());
+        std::string name = traceThreadName().empty() ? "thread " + std::to_string(tid) : traceThreadName();
+        buffers.emplace_back(new TraceBuffer(capacity, tid, name));
+        return buffers.back().get();
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers; // buffers outlive their threads
+    std::atomic<int> generation{0};
+    size_t capacity = 1 << 18;
+    int64_t origin_ns = 0;
+};
+#endif
@@ -0,0 +1,134 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "tracer.h"
+
+// Thread pool with one task deque per worker. A worker pops its own newest
+// task and, when its deque runs dry, steals the oldest task of another
+// worker, so a few long tasks do not leave the other cores idle.
+class WorkStealingPool
+{
+public:
+    typedef std::function<void(int)> Task; // called with the worker index
+
+    // threads = 0 -> one worker per hardware thread
+    WorkStealingPool(int threads = 0)
+    {
+        if(threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        queues = std::vector<Queue>(threads);
+        for(int t=0;t<threads;t++)
+            workers.emplace_back([this, t]() {workerLoop(t);});
+    }
+    ~WorkStealingPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for(auto& w : workers) w.join();
+    }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int size() const { return int(workers.size()); }
+
+    // tasks are dealt round-robin, stealing evens out the rest
+    void submit(Task task)
+    {
+        int q = int(next_queue++ % queues.size());
+        {
+            std::lock_guard<std::mutex> lock(queues[q].mutex);
+            queues[q].tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    // block until every submitted task has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() {return pending == 0;});
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool popLocal(int t, Task& task)
+    {
+        std::lock_guard<std::mutex> lock(queues[t].mutex);
+        if(queues[t].tasks.empty()) return false;
+        task = std::move(queues[t].tasks.back());
+        queues[t].tasks.pop_back();
+        return true;
+    }
+    bool steal(int t, Task& task)
+    {
+        for(size_t k=1;k<queues.size();k++)
+        {
+            Queue& victim = queues[(t+k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+    void workerLoop(int t)
+    {
+        traceThreadName() = "stealing worker " + std::to_string(t);
+        while(true)
+        {
+            Task task;
+            if(popLocal(t, task) || steal(t, task))
+            {
+                task(t);
+                std::lock_guard<std::mutex> lock(mutex);
+                if(--pending == 0) done.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            if(stop) return;
+            // sleep only when nothing is left to take
+            wake.wait_for(lock, std::chrono::milliseconds(10), [this]() {return stop || queuedTasks() > 0;});
+        }
+    }
+    int queuedTasks()
+    {
+        int queued = 0;
+        for(auto& q : queues)
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            queued += int(q.tasks.size());
+        }
+        return queued;
+    }
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> next_queue{0};
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    int pending = 0;
+    bool stop = false;
+};
+#endif